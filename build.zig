@@ -15,13 +15,11 @@ pub fn build(b: *std.Build) void {
         "-Wstrict-prototypes",
     };
 
-    const examples = [_][]const u8{ "rgb-picker", "transparent" };
+    const examples = [_][]const u8{ "rgb-picker", "transparent", "benchmark", "replay", "check" };
     for (examples) |name| {
         const exe = b.addExecutable(.{ .name = name, .root_module = b.createModule(.{ .target = target, .optimize = optimize }) });
         exe.addCSourceFile(.{ .file = b.path(b.fmt("./examples/{s}/main.c", .{name})), .flags = &c_flags });
-        exe.addCSourceFile(.{ .file = b.path("./examples/utils/key-input.c"), .flags = &c_flags });
         exe.addIncludePath(b.path("."));
-        exe.addIncludePath(b.path("./examples/utils"));
         exe.linkLibC();
         b.installArtifact(exe);
 
@@ -29,9 +27,15 @@ pub fn build(b: *std.Build) void {
 
         const run_cmd = b.addRunArtifact(exe);
         run_cmd.step.dependOn(b.getInstallStep());
+        if (b.args) |args| run_cmd.addArgs(args);
 
         const run_step = b.step(b.fmt("run-{s}", .{name}), "Running the example");
         run_step.dependOn(&run_cmd.step);
+
+        if (std.mem.eql(u8, name, "check")) {
+            const test_step = b.step("test", "Run the headless checks");
+            test_step.dependOn(&run_cmd.step);
+        }
     }
     _ = zcc.createStep(b, "cdb", zcc_targets.toOwnedSlice(b.allocator) catch @panic("OOM"));
 }
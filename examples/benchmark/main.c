@@ -0,0 +1,180 @@
+// Measures hot paths of trenderer against the plain loops they replaced.
+// Build with optimizations. (e.g. zig build -Doptimize=ReleaseFast run-benchmark)
+
+#define TR_MAX_FRAMEBUFFER_LEN (200 * 60) // Customize the library however you want.
+
+#define TR_IMPLEMENTATION
+#include "trenderer.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#define WIDTH 200
+#define HEIGHT 60
+#define ITERATIONS 2000
+#define ENCODE_ITERATIONS 200
+#define PARTICLES 5000
+
+// Reference implementations
+// ============================================================================
+void ref_fill_buf(TrCellSpan buf, uint32_t bg) {
+    size_t len = (size_t)(buf.width * buf.height);
+
+    for (size_t i = 0; i < len; i += 1) {
+        strcpy(buf.letter[i], " ");
+    }
+    memset(buf.effects, TR_DEFAULT_EFFECT, len * sizeof(TrEffect));
+
+    for (size_t i = 0; i < len; i += 1) {
+        buf.fg[i] = TR_DEFAULT_COLOR_16;
+        buf.bg[i] = bg;
+    }
+}
+void ref_draw_rect(TrRenderContext *ctx, int x, int y, int width, int height, uint32_t color) {
+    for (int row = 0; row < height; row += 1) {
+        int fb_row_base = x + (y + row) * ctx->width;
+
+        memset(&ctx->back.effects[fb_row_base], TR_DEFAULT_EFFECT, (size_t)width * sizeof(TrEffect));
+
+        for (int col = 0; col < width; col += 1) {
+            int idx = col + fb_row_base;
+
+            strcpy(ctx->back.letter[idx], " ");
+            ctx->back.fg[idx] = color;
+            ctx->back.bg[idx] = color;
+        }
+    }
+}
+void ref_draw_rect_blended(TrRenderContext *ctx, int x, int y, int width, int height, uint32_t color, uint8_t opacity) {
+    for (int row = 0; row < height; row += 1) {
+        int fb_row_base = x + (y + row) * ctx->width;
+
+        for (int col = 0; col < width; col += 1) {
+            int idx = col + fb_row_base;
+
+            ctx->back.fg[idx] = tr_blend(ctx->back.fg[idx], color, opacity);
+            ctx->back.bg[idx] = tr_blend(ctx->back.bg[idx], color, opacity);
+        }
+    }
+}
+// ============================================================================
+
+double elapsed_ns(clock_t start) {
+    return (double)(clock() - start) * 1e9 / CLOCKS_PER_SEC;
+}
+void report(const char *name, double ref_ns, double tr_ns, double cells) {
+    printf("%-12s reference: %7.3f ns/cell   trenderer: %7.3f ns/cell   (x%.2f)\n",
+           name, ref_ns / cells, tr_ns / cells, ref_ns / tr_ns);
+}
+
+TrRenderContext ctx;
+TrSpriteInstance particles[PARTICLES];
+char encode_buf[1 << 20];
+volatile uint32_t sink; // Keeps the results alive.
+
+double encode(TrCellSpan frame, TrEncoder encoder) {
+    clock_t start = clock();
+    for (int i = 0; i < ENCODE_ITERATIONS; i += 1) {
+        size_t idx = 0;
+        tr_strcat_sprite(encode_buf, sizeof(encode_buf), &idx, frame, 0, 0, encoder);
+        sink = (uint32_t)idx;
+    }
+    return elapsed_ns(start);
+}
+
+int main(void) {
+    tr_ctx_init(&ctx, 0, 0, WIDTH, HEIGHT);
+    TrCellSpan back = tr_ftos(&ctx.back, WIDTH, HEIGHT);
+    double cells = (double)WIDTH * HEIGHT * ITERATIONS;
+    clock_t start;
+
+    // Full buffer fill
+    start = clock();
+    for (int i = 0; i < ITERATIONS; i += 1) {
+        ref_fill_buf(back, (uint32_t)i);
+    }
+    double ref_fill = elapsed_ns(start);
+
+    start = clock();
+    for (int i = 0; i < ITERATIONS; i += 1) {
+        tr_fill_buf(back, (uint32_t)i);
+    }
+    double tr_fill = elapsed_ns(start);
+    report("fill_buf", ref_fill, tr_fill, cells);
+
+    // Full screen rectangle
+    start = clock();
+    for (int i = 0; i < ITERATIONS; i += 1) {
+        ref_draw_rect(&ctx, 0, 0, WIDTH, HEIGHT, tr_rgb(0, 0, (uint8_t)i));
+    }
+    double ref_rect = elapsed_ns(start);
+
+    start = clock();
+    for (int i = 0; i < ITERATIONS; i += 1) {
+        tr_ctx_draw_rect(&ctx, 0, 0, WIDTH, HEIGHT, tr_rgb(0, 0, (uint8_t)i));
+    }
+    double tr_rect = elapsed_ns(start);
+    report("draw_rect", ref_rect, tr_rect, cells);
+
+    // Full screen tint
+    start = clock();
+    for (int i = 0; i < ITERATIONS; i += 1) {
+        ref_draw_rect_blended(&ctx, 0, 0, WIDTH, HEIGHT, tr_rgb((uint8_t)i, 80, 160), 100);
+    }
+    double ref_blend = elapsed_ns(start);
+
+    start = clock();
+    for (int i = 0; i < ITERATIONS; i += 1) {
+        tr_ctx_draw_rect_blended(&ctx, 0, 0, WIDTH, HEIGHT, tr_rgb((uint8_t)i, 80, 160), 100);
+    }
+    double tr_blend_ns = elapsed_ns(start);
+    report("blend", ref_blend, tr_blend_ns, cells);
+
+    // Single-cell particles, some of them off the screen
+    TrCellArray spark;
+    tr_carr_init(&spark, 1, 1);
+    strcpy(spark.letter[0], "*");
+    spark.effects[0] = TR_BOLD;
+    spark.fg[0] = TR_ORANGE;
+    spark.bg[0] = TR_TRANSPARENT;
+
+    srand(1);
+    for (int i = 0; i < PARTICLES; i += 1) {
+        particles[i].sprite = tr_atos(&spark);
+        particles[i].x = rand() % (WIDTH + 20) - 10;
+        particles[i].y = rand() % (HEIGHT + 10) - 5;
+    }
+    double particle_cells = (double)PARTICLES * ITERATIONS;
+
+    start = clock();
+    for (int i = 0; i < ITERATIONS; i += 1) {
+        for (int p = 0; p < PARTICLES; p += 1) {
+            tr_ctx_draw_sprite(&ctx, particles[p].sprite, particles[p].x, particles[p].y);
+        }
+    }
+    double ref_particles = elapsed_ns(start);
+
+    start = clock();
+    for (int i = 0; i < ITERATIONS; i += 1) {
+        tr_ctx_draw_sprite_batch(&ctx, particles, PARTICLES);
+    }
+    double tr_particles = elapsed_ns(start);
+    report("particles", ref_particles, tr_particles, particle_cells);
+
+    // Encoding a frame where every cell changes style
+    for (int i = 0; i < WIDTH * HEIGHT; i += 1) {
+        ctx.back.effects[i] = (TrEffect)((i / 7) % 4);
+        ctx.back.fg[i] = tr_rgb((uint8_t)i, (uint8_t)(i * 3), (uint8_t)(i * 7));
+        ctx.back.bg[i] = tr_rgb((uint8_t)(i * 5), 40, (uint8_t)(i / 3));
+    }
+    double encode_cells = (double)WIDTH * HEIGHT * ENCODE_ITERATIONS;
+    double generic = encode(back, tr_encoder(TR_ENCODER_GENERIC, true));
+    report("encode true", generic, encode(back, tr_encoder(TR_ENCODER_TRUE_COLOR, true)), encode_cells);
+    report("encode 256", generic, encode(back, tr_encoder(TR_ENCODER_256, true)), encode_cells);
+    report("encode 16", generic, encode(back, tr_encoder(TR_ENCODER_16, false)), encode_cells);
+
+    sink = ctx.back.bg[WIDTH * HEIGHT - 1];
+
+    return 0;
+}
@@ -0,0 +1,522 @@
+// Headless checks that need no terminal. Aborts on the first failed assert, prints "check OK" otherwise.
+// Covers the command queue, key decoding, the record/replay round-trip with the calls that change later renders, contexts sharing a terminal,
+// that renders using dirty spans leave the same screen as full redraws, and the render pipeline.
+// Renders are written to SCREEN_PATH and read back by a small terminal model instead of a terminal.
+
+#define TR_MAX_FRAMEBUFFER_LEN (40 * 12)
+#define TR_MAX_RAW_BUFFER_LEN (1 << 16)
+
+#define TR_IMPLEMENTATION
+#include "trenderer.h"
+
+#undef NDEBUG // The checks must run in release builds too.
+#include <assert.h>
+#include <stdio.h>
+#include <string.h>
+
+#define W 40
+#define H 12
+#define TRACE_PATH "check.trace"
+#define SCREEN_PATH "check.out"
+#define FRAMES 60
+
+TrRenderContext a, b;
+
+static uint32_t rng_state = 12345;
+static uint32_t rng(uint32_t n) {
+    rng_state = rng_state * 1103515245u + 12345u;
+    return (rng_state >> 16) % n;
+}
+
+static bool same_cells(const TrFramebufferBase *x, const TrFramebufferBase *y) { // Compares the visible content of two framebuffers of a W x H context.
+    for (int i = 0; i < W * H; i += 1) {
+        if (memcmp(x->letter[i], y->letter[i], TR_MAX_UTF8_LEN) != 0 ||
+            x->effects[i] != y->effects[i] || x->fg[i] != y->fg[i] || x->bg[i] != y->bg[i])
+            return false;
+    }
+    return true;
+}
+
+// Command queue
+// ----------------------------------------------------------------------------
+static void check_cmdq(void) {
+    static TrCommandQueue q;
+    TrStyle style = {.effects = TR_UNDERLINE, .fg = TR_YELLOW_16, .bg = TR_BLUE_16};
+
+    tr_cmdq_init(&q);
+    assert(tr_cmdq_push_clear(&q, TR_BLACK_16) == TR_OK);
+    assert(tr_cmdq_push_rect(&q, 2, 1, 10, 4, tr_rgb(200, 40, 40)) == TR_OK);
+    assert(tr_cmdq_push_text(&q, "queued", 6, style, 5, 2) == TR_OK); // Drawn after the rect, so on top of it.
+
+    char long_text[TR_MAX_COMMAND_TEXT_LEN + 1];
+    memset(long_text, 'x', sizeof(long_text));
+    assert(tr_cmdq_push_text(&q, long_text, sizeof(long_text), style, 0, 0) == TR_ERR_BAD_ARG);
+
+    assert(tr_ctx_init(&a, 0, 0, W, H) == TR_OK);
+    assert(tr_ctx_init(&b, 0, 0, W, H) == TR_OK);
+    assert(tr_cmdq_drain(&q, &a) == TR_OK);
+    tr_ctx_clear(&b, TR_BLACK_16);
+    tr_ctx_draw_rect(&b, 2, 1, 10, 4, tr_rgb(200, 40, 40));
+    tr_ctx_draw_text(&b, "queued", 6, style, 5, 2);
+    assert(same_cells(&a.back, &b.back));
+
+    for (int i = 0; i < TR_MAX_COMMAND_QUEUE_LEN; i += 1) {
+        assert(tr_cmdq_push_clear(&q, TR_BLACK_16) == TR_OK);
+    }
+    assert(tr_cmdq_push_clear(&q, TR_BLACK_16) == TR_ERR_BUF_OVERFLOW);
+    assert(tr_cmdq_drain(&q, &a) == TR_OK);
+    assert(tr_cmdq_push_clear(&q, TR_BLACK_16) == TR_OK); // Drained slots are free again.
+    assert(tr_cmdq_drain(&q, &a) == TR_OK);
+}
+
+// Key decoding
+// ----------------------------------------------------------------------------
+static void check_keys(void) {
+    TrEvent ev;
+
+    assert(tr_decode_key("a", 1, false, &ev) == 1);
+    assert(ev.type == TR_EVENT_KEY && ev.key == 'a' && strcmp(ev.text, "a") == 0);
+
+    assert(tr_decode_key("\xc3\xa9x", 3, false, &ev) == 2); // Only the first key is used.
+    assert(ev.key == 0xE9 && strcmp(ev.text, "\xc3\xa9") == 0);
+
+    assert(tr_decode_key("\xf0\x9f\x98\x80", 4, false, &ev) == 4); // A 4-byte key fills TR_MAX_UTF8_LEN and is still terminated.
+    assert(ev.key == 0x1F600 && strcmp(ev.text, "\xf0\x9f\x98\x80") == 0);
+
+    assert(tr_decode_key("\r", 1, false, &ev) == 1);
+    assert(ev.key == TR_KEY_ENTER && ev.text[0] == '\0');
+
+    assert(tr_decode_key("\x1b[A", 3, false, &ev) == 3);
+    assert(ev.key == TR_KEY_UP && ev.mods == 0);
+
+    assert(tr_decode_key("\x1b[1;5C", 6, false, &ev) == 6);
+    assert(ev.key == TR_KEY_RIGHT && ev.mods == TR_MOD_CTRL);
+
+    assert(tr_decode_key("\x1b[15~", 5, false, &ev) == 5);
+    assert(ev.key == TR_KEY_F1 + 4);
+
+    assert(tr_decode_key("\x1bx", 2, false, &ev) == 2);
+    assert(ev.key == 'x' && ev.mods == TR_MOD_ALT);
+
+    assert(tr_decode_key("\x1b[", 2, false, &ev) == 0); // May be the start of a longer sequence.
+    assert(tr_decode_key("\x1b", 1, false, &ev) == 0);
+    assert(tr_decode_key("\x1b", 1, true, &ev) == 1);
+    assert(ev.key == TR_KEY_ESC);
+}
+
+// Record and replay
+// ----------------------------------------------------------------------------
+static int replay_trace(void) { // Replays TRACE_PATH into `b` and returns the number of frames.
+    TrReplayer rp;
+    bool done = false;
+    assert(tr_replay_open(&rp, TRACE_PATH) == TR_OK);
+    assert(rp.width == W && rp.height == H);
+    assert(tr_ctx_init(&b, rp.x, rp.y, rp.width, rp.height) == TR_OK);
+    tr_ctx_set_headless(&b, true);
+    while (true) {
+        assert(tr_replay_frame(&rp, &b, &done) == TR_OK);
+        if (done)
+            break;
+        assert(rp.render_result == TR_OK);
+    }
+
+    int frames = rp.frames;
+    tr_replay_close(&rp);
+    remove(TRACE_PATH);
+    return frames;
+}
+static void draw_frame(TrRenderContext *ctx, int frame) { // Uses most draw calls, so a replay covers them.
+    static const char *cells = "#*#*";
+    TrStyle style = {.effects = TR_BOLD, .fg = TR_WHITE_16, .bg = TR_BLUE_16};
+    TrStyle line = {.effects = TR_DIM, .fg = TR_CYAN_16, .bg = TR_TRANSPARENT}; // Lines keep the colors below.
+
+    tr_ctx_clear(ctx, TR_BLACK_16);
+    tr_ctx_draw_rect(ctx, frame % W, 2, 8, 3, tr_rgb((uint8_t)(frame * 4), 80, 160));
+    tr_ctx_draw_rect_blended(ctx, 0, 0, W, 2, TR_RED_16, 128);
+    tr_ctx_draw_text(ctx, "trenderer", 9, style, W - 10 - frame % 20, 6);
+    tr_ctx_draw_hline(ctx, 0, H - 1, W, "-", line);
+    tr_ctx_draw_vline(ctx, frame % W, 0, H, "|", line);
+
+    static TrCellArray arr;
+    tr_carr_init(&arr, 2, 2);
+    TrCellSpan sprite = tr_atos(&arr);
+    for (int i = 0; i < 4; i += 1) {
+        memcpy(sprite.letter[i], (char[TR_MAX_UTF8_LEN]){cells[i]}, TR_MAX_UTF8_LEN);
+        sprite.fg[i] = TR_GREEN_16;
+        sprite.bg[i] = TR_TRANSPARENT;
+    }
+    tr_ctx_draw_sprite(ctx, sprite, 3, 8);
+    tr_ctx_draw_sprite_blended(ctx, sprite, 6, 8, 96);
+    tr_ctx_draw_sprite_transformed(ctx, sprite, 9, 8, (TrTransform){.rotation = 90, .scale = 2});
+
+    uint8_t pixels[4 * 4 * 3];
+    for (int i = 0; i < (int)sizeof(pixels); i += 1) {
+        pixels[i] = (uint8_t)(i * 16 + frame);
+    }
+    tr_ctx_draw_image(ctx, pixels, 4, 4, 3, 20, 8, 4, 2);
+}
+static void check_replay(void) { // Calls that change later renders are recorded too, so the replay writes the same bytes.
+    TrRecorder rec;
+    size_t bytes[6];
+
+    assert(tr_ctx_init(&a, 0, 0, W, H) == TR_OK);
+    tr_ctx_set_headless(&a, true);
+    assert(tr_rec_open(&rec, TRACE_PATH, &a) == TR_OK);
+    for (int i = 0; i < 6; i += 1) {
+        draw_frame(&a, i);
+        if (i == 1) {
+            tr_ctx_set_encoder(&a, tr_encoder(TR_ENCODER_256, true));
+            tr_ctx_set_caps(&a, TR_CAP_REP | TR_CAP_ECH);
+            tr_ctx_set_tolerance(&a, 12);
+        } else if (i == 2) {
+            tr_ctx_set_lazy_clear(&a, true);
+            assert(tr_ctx_set_style_table(&a, true) == TR_OK);
+        } else if (i == 3) {
+            assert(tr_ctx_scroll(&a, 2, 6, 2) == TR_OK);
+            tr_ctx_invalidate(&a, 30, 0, 10, 3);
+        } else if (i == 4) {
+            assert(tr_ctx_resize(&a, W - 4, H - 2) == TR_OK);
+            tr_ctx_forget_terminal(&a);
+        } else if (i == 5) {
+            assert(tr_ctx_resize(&a, W, H) == TR_OK);
+            tr_ctx_invalidate_all(&a);
+        }
+        assert(tr_ctx_render(&a) == TR_OK);
+        bytes[i] = a.stats.bytes;
+    }
+    draw_frame(&a, 6); // Left unrendered, so only `back` has it.
+    assert(tr_ctx_set_style_table(&a, false) == TR_OK);
+    assert(tr_rec_close(&rec, &a) == TR_OK);
+
+    TrReplayer rp;
+    bool done = false;
+    assert(tr_replay_open(&rp, TRACE_PATH) == TR_OK);
+    assert(tr_ctx_init(&b, rp.x, rp.y, rp.width, rp.height) == TR_OK);
+    tr_ctx_set_headless(&b, true);
+    for (int i = 0; i < 6; i += 1) {
+        assert(tr_replay_frame(&rp, &b, &done) == TR_OK && !done);
+        assert(rp.render_result == TR_OK);
+        assert(b.stats.bytes == bytes[i]);
+    }
+    assert(tr_replay_frame(&rp, &b, &done) == TR_OK && done);
+    assert(!b.style_table); // Freed like in `a`.
+    tr_replay_close(&rp);
+    remove(TRACE_PATH);
+
+    assert(same_cells(&a.front, &b.front));
+    assert(same_cells(&a.back, &b.back));
+}
+static void check_replay_lines(void) { // 4-byte letters fill their cells, so the cells have no \0.
+    static const char *emoji = "\xf0\x9f\x98\x80";
+    TrStyle style = {.effects = TR_BOLD, .fg = TR_YELLOW_16, .bg = TR_BLACK_16};
+    TrRecorder rec;
+
+    assert(tr_ctx_init(&a, 0, 0, W, H) == TR_OK);
+    tr_ctx_set_headless(&a, true);
+    assert(tr_ctx_draw_hline(&a, 0, 0, W, "abcde", style) == TR_ERR_BAD_ARG);
+
+    assert(tr_rec_open(&rec, TRACE_PATH, &a) == TR_OK);
+    assert(tr_ctx_draw_hline(&a, 0, 1, W, emoji, style) == TR_OK);
+    assert(tr_ctx_draw_vline(&a, 3, 0, H, "\xf0\x9f\x8c\x8d", style) == TR_OK);
+    assert(tr_ctx_render(&a) == TR_OK);
+    assert(tr_ctx_draw_hline(&a, 0, H - 1, W, "\xe2\x94\x80", style) == TR_OK);
+    assert(tr_rec_close(&rec, &a) == TR_OK);
+    assert(memcmp(a.back.letter[W + 5], emoji, TR_MAX_UTF8_LEN) == 0);
+
+    assert(replay_trace() == 1);
+    assert(same_cells(&a.front, &b.front));
+    assert(same_cells(&a.back, &b.back));
+}
+
+// Terminal model
+// ----------------------------------------------------------------------------
+// Only what the renderer writes is modeled: cursor moves, SGR, scroll regions and printed letters.
+typedef struct Screen {
+    char letter[W * H][TR_MAX_UTF8_LEN];
+    TrStyle style[W * H];
+    TrStyle pen;
+    int x, y;
+    int top, bottom; // Scroll region [top, bottom).
+} Screen;
+
+Screen screen_a, screen_b;
+FILE *screen_out; // Reads back what is written to stdout, which goes to SCREEN_PATH.
+
+static void screen_sgr(TrStyle *pen, const int *params, int count) {
+    static const TrEffect effects[10] = {0, TR_BOLD, TR_DIM, TR_ITALIC, TR_UNDERLINE, TR_BLINK, 0, TR_INVERT, TR_INVISIBLE, TR_STRIKETHROUGH};
+
+    if (count == 0)
+        *pen = tr_default_style();
+    for (int i = 0; i < count; i += 1) {
+        int p = params[i];
+        uint32_t *color = p / 10 == 3 || p / 10 == 9 ? &pen->fg : &pen->bg;
+
+        if (p == 0) {
+            *pen = tr_default_style();
+        } else if (p < 10) {
+            pen->effects |= effects[p];
+        } else if (p == 22) {
+            pen->effects &= ~(TR_BOLD | TR_DIM);
+        } else if (p > 22 && p < 30) {
+            pen->effects &= ~effects[p - 20];
+        } else if (p == 39 || p == 49) {
+            *color = TR_DEFAULT_COLOR_16;
+        } else if ((p == 38 || p == 48) && i + 2 < count && params[i + 1] == 5) {
+            *color = tr_color_256((uint8_t)params[i + 2]);
+            i += 2;
+        } else if ((p == 38 || p == 48) && i + 4 < count && params[i + 1] == 2) {
+            *color = tr_rgb((uint8_t)params[i + 2], (uint8_t)params[i + 3], (uint8_t)params[i + 4]);
+            i += 4;
+        } else if ((p >= 30 && p <= 47) || (p >= 90 && p <= 107)) {
+            *color = tr_color_16((uint8_t)(p % 10 + (p >= 90 ? 90 : 30)));
+        } else {
+            assert(!"unexpected SGR parameter");
+        }
+    }
+}
+static void screen_feed(Screen *s, const char *bytes, size_t len) {
+    for (size_t i = 0; i < len;) {
+        if (bytes[i] != '\x1b') {
+            uint8_t lead = (uint8_t)bytes[i];
+            size_t n = lead < 0x80 ? 1 : lead < 0xE0 ? 2 : lead < 0xF0 ? 3 : 4;
+            assert(n <= len - i);
+            if (s->x < W && s->y < H) {
+                int idx = s->x + s->y * W;
+                memset(s->letter[idx], 0, TR_MAX_UTF8_LEN);
+                memcpy(s->letter[idx], &bytes[i], n);
+                s->style[idx] = s->pen;
+            }
+            s->x += 1;
+            i += n;
+            continue;
+        }
+
+        assert(i + 1 < len && bytes[i + 1] == '[');
+        i += 2;
+        bool private_mode = i < len && bytes[i] == '?';
+        if (private_mode) // Cursor visibility and the like.
+            i += 1;
+
+        int params[16] = {0};
+        int count = 0; // 0 without parameters, e.g. "\x1b[m".
+        for (; i < len && (bytes[i] < 0x40 || bytes[i] > 0x7E); i += 1) {
+            if (count == 0)
+                count = 1;
+            if (bytes[i] == ';') {
+                assert(count < 16);
+                count += 1;
+            } else {
+                params[count - 1] = params[count - 1] * 10 + (bytes[i] - '0');
+            }
+        }
+        assert(i < len);
+        char final = bytes[i];
+        i += 1;
+
+        if (private_mode)
+            continue;
+        switch (final) {
+        case 'H':
+            s->y = count > 0 ? params[0] - 1 : 0;
+            s->x = count > 1 ? params[1] - 1 : 0;
+            break;
+        case 'C':
+            s->x += count > 0 && params[0] > 0 ? params[0] : 1;
+            break;
+        case 'm':
+            screen_sgr(&s->pen, params, count);
+            break;
+        case 'r':
+            s->top = count > 0 ? params[0] - 1 : 0;
+            s->bottom = count > 1 ? params[1] : H;
+            s->x = 0;
+            s->y = 0;
+            break;
+        case 'S': { // New rows get the current bg only.
+            int n = count > 0 && params[0] > 0 ? params[0] : 1;
+            TrStyle blank = tr_default_style();
+            blank.bg = s->pen.bg;
+            for (int y = s->top; y < s->bottom; y += 1) {
+                for (int x = 0; x < W; x += 1) {
+                    int idx = x + y * W;
+                    if (y + n < s->bottom) {
+                        memcpy(s->letter[idx], s->letter[idx + n * W], TR_MAX_UTF8_LEN);
+                        s->style[idx] = s->style[idx + n * W];
+                    } else {
+                        memset(s->letter[idx], 0, TR_MAX_UTF8_LEN);
+                        s->letter[idx][0] = ' ';
+                        s->style[idx] = blank;
+                    }
+                }
+            }
+            break;
+        }
+        default:
+            assert(!"unexpected escape sequence");
+        }
+    }
+}
+static void screen_read(Screen *s) { // Feeds what was written since the last read.
+    static char buf[TR_MAX_RAW_BUFFER_LEN];
+
+    fflush(stdout);
+    size_t n = fread(buf, 1, sizeof(buf), screen_out);
+    screen_feed(s, buf, n);
+    clearerr(screen_out);
+}
+static bool screen_matches(const Screen *s, const TrRenderContext *ctx) { // Compares the area of `ctx` with its `back`.
+    for (int i = 0; i < ctx->width * ctx->height; i += 1) {
+        int idx = ctx->x + i % ctx->width + (ctx->y + i / ctx->width) * W;
+        if (memcmp(s->letter[idx], ctx->back.letter[i], TR_MAX_UTF8_LEN) != 0 || s->style[idx].effects != ctx->back.effects[i] ||
+            s->style[idx].fg != ctx->back.fg[i] || s->style[idx].bg != ctx->back.bg[i])
+            return false;
+    }
+    return true;
+}
+static void screen_open(void) {
+    assert(freopen(SCREEN_PATH, "wb", stdout) != NULL);
+    screen_out = fopen(SCREEN_PATH, "rb");
+    assert(screen_out != NULL);
+}
+static void screen_close(void) {
+    fclose(screen_out);
+    remove(SCREEN_PATH);
+}
+static void draw_changes(TrRenderContext *ctx, int frame) { // A full repaint every 10 frames, a few small changes in the others.
+    TrStyle style = {.effects = (TrEffect)rng(1 << TR_EFFECTS_LEN), .fg = tr_color_16((uint8_t)(30 + rng(8))), .bg = tr_color_256((uint8_t)rng(256))};
+
+    if (frame % 10 == 0) {
+        for (int i = 0; i < W * H; i += 1) {
+            tr_ctx_draw_rect(ctx, i % W, i / W, 1, 1, tr_rgb((uint8_t)rng(256), (uint8_t)rng(256), (uint8_t)rng(256)));
+        }
+        return;
+    }
+    for (int i = 0; i < 3; i += 1) {
+        tr_ctx_draw_rect(ctx, (int)rng(W), (int)rng(H), 1 + (int)rng(6), 1 + (int)rng(2), tr_color_16((uint8_t)(90 + rng(8))));
+        tr_ctx_draw_text(ctx, "span", 4, style, (int)rng(W), (int)rng(H));
+    }
+}
+static void check_shared_terminal(void) { // Two contexts and `tr_XXX` calls write to one terminal. Each render must not trust the style it left.
+    screen_open();
+    assert(tr_ctx_init(&a, 0, 0, W, H / 2) == TR_OK);
+    assert(tr_ctx_init(&b, 0, H / 2, W, H - H / 2) == TR_OK);
+
+    for (int frame = 0; frame < FRAMES; frame += 1) {
+        draw_changes(&a, frame);
+        draw_changes(&b, frame);
+
+        assert(tr_ctx_render(&a) == TR_OK);
+        if (frame % 3 == 0) { // Moves the cursor and changes the style, but prints nothing.
+            tr_move_cursor(0, 0);
+            tr_add_effects(TR_ITALIC);
+            assert(tr_set_bg(tr_color_256((uint8_t)rng(256))) == TR_OK);
+        }
+        assert(tr_ctx_render(&b) == TR_OK);
+        screen_read(&screen_a);
+
+        assert(screen_matches(&screen_a, &a));
+        assert(screen_matches(&screen_a, &b));
+    }
+    screen_close();
+}
+
+// Full vs span renders
+// ----------------------------------------------------------------------------
+static void check_spans(void) {
+    screen_open();
+
+    // `a` renders dirty spans when it is cheaper, `b` is invalidated to draw every frame in full.
+    assert(tr_ctx_init(&a, 0, 0, W, H) == TR_OK);
+    assert(tr_ctx_init(&b, 0, 0, W, H) == TR_OK);
+    int full = 0, spans = 0;
+
+    for (int frame = 0; frame < FRAMES; frame += 1) {
+        uint32_t seed = rng_state;
+        draw_changes(&a, frame);
+        rng_state = seed;
+        draw_changes(&b, frame);
+
+        assert(tr_ctx_render(&a) == TR_OK);
+        screen_read(&screen_a);
+        full += a.stats.full_redraw;
+        spans += !a.stats.full_redraw && a.stats.cells > 0;
+
+        tr_ctx_invalidate_all(&b);
+        assert(tr_ctx_render(&b) == TR_OK);
+        assert(b.stats.full_redraw);
+        screen_read(&screen_b);
+
+        assert(screen_matches(&screen_a, &a));
+        assert(screen_matches(&screen_b, &b));
+        assert(memcmp(screen_a.letter, screen_b.letter, sizeof(screen_a.letter)) == 0);
+    }
+    assert(full > 0 && spans > 0); // Both strategies were used.
+
+    screen_close();
+}
+
+// Render pipeline
+// ----------------------------------------------------------------------------
+static void check_pipeline(void) { // Random frames and settings are submitted, and the pipeline is detached at random. After a flush, the screen must show the last submitted frame.
+    static TrPipeline pipe;
+    screen_open();
+    assert(tr_ctx_init(&a, 0, 0, W, H) == TR_OK);
+    assert(tr_pipe_init(&pipe) == TR_OK);
+    tr_ctx_set_pipeline(&a, &pipe);
+    int checked = 0, detached = 0;
+
+    for (int frame = 0; frame < FRAMES * 2; frame += 1) {
+        switch (rng(10)) {
+        case 0:
+            assert(tr_ctx_scroll(&a, (int)rng(H / 2), H / 2, 1 + (int)rng(H / 2)) == TR_OK);
+            break;
+        case 1:
+            tr_ctx_invalidate(&a, (int)rng(W), (int)rng(H), 1 + (int)rng(10), 1 + (int)rng(4));
+            break;
+        case 2:
+            assert(tr_ctx_set_style_table(&a, !a.style_table) == TR_OK);
+            break;
+        case 3:
+            tr_ctx_set_lazy_clear(&a, !a.lazy_clear);
+            break;
+        case 4:
+            tr_ctx_clear(&a, tr_color_256((uint8_t)rng(256)));
+            break;
+        case 5: // Takes the screen back and renders on this thread for a while.
+            tr_ctx_set_pipeline(&a, a.pipeline != NULL ? NULL : &pipe);
+            detached += a.pipeline == NULL;
+            break;
+        default:
+            break;
+        }
+        draw_changes(&a, frame);
+        assert(tr_ctx_submit(&a) == TR_OK);
+
+        if (rng(4) == 0) {
+            tr_pipe_flush(&pipe);
+            screen_read(&screen_a);
+            assert(screen_matches(&screen_a, &a));
+            checked += 1;
+        }
+    }
+    assert(checked > 0 && detached > 0);
+
+    tr_ctx_set_pipeline(&a, NULL);
+    tr_pipe_cleanup(&pipe);
+    screen_read(&screen_a);
+    assert(screen_matches(&screen_a, &a));
+    assert(tr_ctx_set_style_table(&a, false) == TR_OK);
+    screen_close();
+}
+int main(void) {
+    check_cmdq();
+    check_keys();
+    check_replay();
+    check_replay_lines();
+    check_shared_terminal();
+    check_spans();
+    check_pipeline();
+
+    fprintf(stderr, "check OK\n");
+    return 0;
+}
@@ -0,0 +1,78 @@
+// Replays a trace recorded with `tr_rec_open` on a headless context, and prints the time and bytes of each frame.
+// Without arguments, it records a short animation to demo.trace first.
+
+#define TR_MAX_FRAMEBUFFER_LEN (80 * 24) // Must fit the recorded context.
+#define TR_MAX_RAW_BUFFER_LEN (1 << 16)  // Must fit the largest frame, or its render fails.
+
+#define TR_IMPLEMENTATION
+#include "trenderer.h"
+
+#include <stdio.h>
+
+#define DEMO_PATH "demo.trace"
+#define DEMO_FRAMES 300
+
+TrRenderContext ctx;
+
+TrResult record_demo(void) {
+    TR_CHK(tr_ctx_init(&ctx, 0, 0, 80, 24));
+    tr_ctx_set_headless(&ctx, true);
+
+    TrRecorder rec;
+    TR_CHK(tr_rec_open(&rec, DEMO_PATH, &ctx));
+
+    TrStyle style = {.effects = TR_BOLD, .fg = TR_WHITE_16, .bg = TR_BLACK_16};
+    for (int i = 0; i < DEMO_FRAMES; i += 1) {
+        tr_ctx_clear(&ctx, TR_BLACK_16);
+        tr_ctx_draw_rect(&ctx, i % 80, 5, 10, 4, tr_rgb((uint8_t)i, 80, 160));
+        tr_ctx_draw_text(&ctx, "trenderer", 9, style, 70 - i % 70, 12);
+        tr_ctx_render(&ctx);
+    }
+
+    return tr_rec_close(&rec, &ctx);
+}
+int main(int argc, char **argv) {
+    const char *path = argc > 1 ? argv[1] : DEMO_PATH;
+    if (argc <= 1 && record_demo() != TR_OK) {
+        fprintf(stderr, "failed to record %s\n", DEMO_PATH);
+        return 1;
+    }
+
+    TrReplayer rp;
+    if (tr_replay_open(&rp, path) != TR_OK) {
+        fprintf(stderr, "failed to open %s\n", path);
+        return 1;
+    }
+    if (tr_ctx_init(&ctx, rp.x, rp.y, rp.width, rp.height) != TR_OK) {
+        fprintf(stderr, "%dx%d does not fit TR_MAX_FRAMEBUFFER_LEN\n", rp.width, rp.height);
+        tr_replay_close(&rp);
+        return 1;
+    }
+    tr_ctx_set_headless(&ctx, true);
+
+    double total_ms = 0.0, max_ms = 0.0;
+    size_t total_bytes = 0;
+    bool done = false;
+
+    printf("frame       ms    bytes  cells\n");
+    while (true) {
+        if (tr_replay_frame(&rp, &ctx, &done) != TR_OK) {
+            fprintf(stderr, "%s is malformed after frame %u\n", path, rp.frames);
+            break;
+        }
+        if (done)
+            break;
+
+        printf("%5u %8.4f %8zu %6u%s\n", rp.frames, rp.frame_ms, ctx.stats.bytes, ctx.stats.cells, rp.render_result != TR_OK ? "  render failed" : "");
+        total_ms += rp.frame_ms;
+        total_bytes += ctx.stats.bytes;
+        if (rp.frame_ms > max_ms)
+            max_ms = rp.frame_ms;
+    }
+
+    if (rp.frames > 0)
+        printf("%u frames, %.4f ms avg, %.4f ms max, %zu bytes\n", rp.frames, total_ms / rp.frames, max_ms, total_bytes);
+    tr_replay_close(&rp);
+
+    return 0;
+}
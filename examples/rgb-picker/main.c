@@ -1,11 +1,6 @@
-// ki_XXX functions are not from trenderer. Check ./examples/utils/key-input.h 
-
 #define TR_IMPLEMENTATION
 #include "trenderer.h"
 
-#include "key-input.h"
-#define ESC 27
-
 #include <stdio.h>
 
 #define STR_LEN 7
@@ -13,12 +8,18 @@
 #define G 1
 #define B 2
 
-#define MY_CHK(x)          \
-    do {                   \
-        if ((x) != TR_OK)  \
-            alive = false; \
+#define MY_CHK(x)               \
+    do {                        \
+        if ((x) != TR_OK)       \
+            tr_loop_stop(loop); \
     } while (0)
 
+typedef struct App {
+    TrRenderContext ctx;
+    uint8_t rgb[3];
+    int target;
+} App;
+
 void increase_color(uint8_t *rgb, int target) {
     if (rgb[target] == 255)
         rgb[target] = 0;
@@ -69,54 +70,61 @@ TrResult draw_color(TrRenderContext *ctx, uint8_t *rgb, int idx, int target) {
 
     return tr_ctx_draw_text(ctx, str, strlen(str), style, pos, 0);
 }
-void process_input(uint8_t *rgb, int *target, bool *alive) {
-    int key = ki_get();
+void on_event(TrLoop *loop, const TrEvent *event) {
+    App *app = loop->user;
+    if (event->type != TR_EVENT_KEY)
+        return;
 
-    switch (key) {
+    switch (event->key) {
     case 'w':
-        increase_color(rgb, *target);
+    case TR_KEY_UP:
+        increase_color(app->rgb, app->target);
         break;
     case 'a':
-        decrease_target(target);
+    case TR_KEY_LEFT:
+        decrease_target(&app->target);
         break;
     case 's':
-        decrease_color(rgb, *target);
+    case TR_KEY_DOWN:
+        decrease_color(app->rgb, app->target);
         break;
     case 'd':
-        increase_target(target);
+    case TR_KEY_RIGHT:
+        increase_target(&app->target);
         break;
-    case ESC:
-        *alive = false;
+    case TR_KEY_ESC:
+        tr_loop_stop(loop);
         break;
     }
 }
-int main(void) {
-    uint8_t rgb[3] = {0, 0, 0};
-    int target = 0;
-    bool alive = true;
+void on_frame(TrLoop *loop, double dt) { // Only called after a key, because the loop runs with 0 fps.
+    App *app = loop->user;
+    (void)dt;
 
-    TrRenderContext ctx;
-    tr_ctx_init(&ctx, 0, 0, 21, 5);
+    tr_ctx_clear(&app->ctx, TR_DEFAULT_COLOR_16);
+
+    MY_CHK(draw_color(&app->ctx, app->rgb, R, app->target));
+    MY_CHK(draw_color(&app->ctx, app->rgb, G, app->target));
+    MY_CHK(draw_color(&app->ctx, app->rgb, B, app->target));
+
+    MY_CHK(tr_ctx_draw_rect(&app->ctx, 0, 1, 21, 4, tr_rgb(app->rgb[R], app->rgb[G], app->rgb[B])));
+
+    MY_CHK(tr_ctx_render(&app->ctx));
+}
+int main(void) {
+    App app = {.rgb = {0, 0, 0}, .target = 0};
+    tr_ctx_init(&app.ctx, 0, 0, 21, 5);
 
     tr_init(false);
 
     tr_open_alt();
     tr_hide_cursor();
-    ki_init();
-    while (alive) {
-        process_input(rgb, &target, &alive);
 
-        tr_ctx_clear(&ctx, TR_DEFAULT_COLOR_16);
+    TrLoop loop;
+    tr_loop_init(&loop, 0, on_event, on_frame, &app);
+    tr_loop_run(&loop);
 
-        MY_CHK(draw_color(&ctx, rgb, R, target));
-        MY_CHK(draw_color(&ctx, rgb, G, target));
-        MY_CHK(draw_color(&ctx, rgb, B, target));
-
-        MY_CHK(tr_ctx_draw_rect(&ctx, 0, 1, 21, 4, tr_rgb(rgb[R], rgb[G], rgb[B])));
-
-        MY_CHK(tr_ctx_render(&ctx));
-    }
-    ki_reset();
+    tr_ctx_reset_terminal(&app.ctx);
     tr_show_cursor();
     tr_close_alt();
 
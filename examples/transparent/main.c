@@ -1,21 +1,21 @@
-// ki_XXX functions are not from trenderer. Check ./examples/utils/key-input.h
-
 #define TR_MAX_CELL_ARRAY_LEN 9 // Customize the library however you want.
 #define TR_MAX_FRAMEBUFFER_LEN 200
 
 #define TR_IMPLEMENTATION
 #include "trenderer.h"
 
-#include "key-input.h"
-
-#define ESC 27
-
-#define MY_CHK(x)          \
-    do {                   \
-        if ((x) != TR_OK)  \
-            alive = false; \
+#define MY_CHK(x)               \
+    do {                        \
+        if ((x) != TR_OK)       \
+            tr_loop_stop(loop); \
     } while (0)
 
+typedef struct App {
+    TrRenderContext ctx;
+    TrCellArray box;
+    int pos_x, pos_y;
+} App;
+
 void fill_box(TrCellArray *box) {
     for (int i = 0; i < box->width * box->height; i += 1) {
         strcpy(box->letter[i], "Ф"); // Add unicode letters.
@@ -24,60 +24,62 @@ void fill_box(TrCellArray *box) {
         box->bg[i] = TR_TRANSPARENT;
     }
 }
-void process_input(int *pos_x, int *pos_y, bool *alive) {
-    int key = ki_get();
+void on_event(TrLoop *loop, const TrEvent *event) {
+    App *app = loop->user;
+    if (event->type != TR_EVENT_KEY)
+        return;
 
-    switch (key) {
+    switch (event->key) {
     case 'w':
-        *pos_y -= 1;
+        app->pos_y -= 1;
         break;
     case 'a':
-        *pos_x -= 1;
+        app->pos_x -= 1;
         break;
     case 's':
-        *pos_y += 1;
+        app->pos_y += 1;
         break;
     case 'd':
-        *pos_x += 1;
+        app->pos_x += 1;
         break;
-    case ESC:
-        *alive = false;
+    case TR_KEY_ESC:
+        tr_loop_stop(loop);
         break;
     }
 }
+void on_frame(TrLoop *loop, double dt) {
+    App *app = loop->user;
+    (void)dt;
+
+    tr_ctx_clear(&app->ctx, TR_DEFAULT_COLOR_16);
+
+    MY_CHK(tr_ctx_draw_rect(&app->ctx, 0, 0, 10, 5, TR_RED_16));
+    MY_CHK(tr_ctx_draw_rect(&app->ctx, 10, 0, 10, 5, TR_ORANGE));         // Use various
+    MY_CHK(tr_ctx_draw_rect(&app->ctx, 0, 5, 10, 5, TR_BRIGHT_CYAN_256)); // kinds of
+    MY_CHK(tr_ctx_draw_rect(&app->ctx, 10, 5, 10, 5, TR_WHITE_16));       // colors easily.
 
+    MY_CHK(tr_ctx_draw_sprite(&app->ctx, tr_atos(&app->box), app->pos_x, app->pos_y));
+
+    MY_CHK(tr_ctx_render(&app->ctx));
+}
 int main(void) {
-    int pos_x = 0;
-    int pos_y = 0;
-    bool alive = true;
-    TrCellArray box;
-    tr_carr_init(&box, 3, 3);
-    fill_box(&box);
+    App app = {.pos_x = 0, .pos_y = 0};
+    tr_carr_init(&app.box, 3, 3);
+    fill_box(&app.box);
 
-    TrRenderContext ctx;
-    tr_ctx_init(&ctx, 0, 0, 20, 10);
+    tr_ctx_init(&app.ctx, 0, 0, 20, 10);
 
     tr_init(true); // Setup for unicode.
 
     tr_open_alt();
     tr_hide_cursor();
-    ki_init();
-    while (alive) {
-        process_input(&pos_x, &pos_y, &alive);
 
-        tr_ctx_clear(&ctx, TR_DEFAULT_COLOR_16);
+    TrLoop loop;
+    tr_loop_init(&loop, 0, on_event, on_frame, &app); // Draws only after a key, so it sleeps while idle.
+    tr_loop_run(&loop);
 
-        MY_CHK(tr_ctx_draw_rect(&ctx, 0, 0, 10, 5, TR_RED_16));
-        MY_CHK(tr_ctx_draw_rect(&ctx, 10, 0, 10, 5, TR_ORANGE));         // Use various
-        MY_CHK(tr_ctx_draw_rect(&ctx, 0, 5, 10, 5, TR_BRIGHT_CYAN_256)); // kinds of
-        MY_CHK(tr_ctx_draw_rect(&ctx, 10, 5, 10, 5, TR_WHITE_16));       // colors easily.
-
-        MY_CHK(tr_ctx_draw_sprite(&ctx, tr_atos(&box), pos_x, pos_y));
-
-        MY_CHK(tr_ctx_render(&ctx));
-    }
-    ki_reset();
-	tr_show_cursor();
+    tr_ctx_reset_terminal(&app.ctx);
+    tr_show_cursor();
     tr_close_alt();
 
     return 0;
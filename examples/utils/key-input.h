@@ -1,8 +0,0 @@
-#ifndef KEY_INPUT_H
-#define KEY_INPUT_H
-
-void ki_init(void);
-void ki_reset(void);
-int ki_get(void);
-
-#endif // KEY_INPUT_H
@@ -1,6 +1,15 @@
 #ifndef TR_H
 #define TR_H
 
+// clang-format off
+#if defined(TR_IMPLEMENTATION) && !defined(_WIN32) && !defined(_WIN64) && !defined(_POSIX_C_SOURCE)
+    #define _POSIX_C_SOURCE 200809L // POSIX functions are hidden with -std=c99. Include this header first in the implementation file.
+#endif
+#if defined(TR_IMPLEMENTATION) && defined(__APPLE__) && !defined(_DARWIN_C_SOURCE)
+    #define _DARWIN_C_SOURCE // SIGWINCH and TIOCGWINSZ are hidden by _POSIX_C_SOURCE on macOS.
+#endif
+// clang-format on
+
 /* ============================================================================
  *
  * trenderer v0.4.1
@@ -10,7 +19,7 @@
  *
  *     NAMESPACES AND CONVENTIONS:
  *         Everything is in `tr` namespace. Macros and enum members are ALL_CAPS, structs and enums are PascalCase, and anything else is snake_case.
- *         `tr_carr_XXX`(TrCellArray), `tr_cvec_XXX`(TrCellVector), `tr_ctx_XXX`(TrRenderContext) mean they are OOP functions.
+ *         `tr_carr_XXX`(TrCellArray), `tr_cvec_XXX`(TrCellVector), `tr_ctx_XXX`(TrRenderContext), `tr_wr_XXX`(TrWriter), `tr_tpane_XXX`(TrTextPane), `tr_cmdq_XXX`(TrCommandQueue), `tr_aw_XXX`(TrAsyncWriter), `tr_loop_XXX`(TrLoop), `tr_rec_XXX`(TrRecorder), `tr_replay_XXX`(TrReplayer), `tr_pipe_XXX`(TrPipeline) mean they are OOP functions.
  *
  *     DEFINES:
  *         #define TR_IMPLEMENTATION
@@ -25,6 +34,9 @@
  *         #define TR_MALLOC [func] / #define TR_FREE [func]
  *             Define custom functions to replace standard malloc and free.
  *
+ *         #define TR_MAX_WRITER_BUFFER_LEN 4096
+ *             The length of the internal buffer of `TrWriter`. The default value is 4096 and you can define other value before you include the header.
+ *
  *         #define TR_MAX_CELL_ARRAY_LEN 64
  *             The length of `TrCellArray`. The default value is 64 and you can define other value before you include the header.
  *
@@ -34,9 +46,34 @@
  *         #define TR_MAX_RAW_BUFFER_LEN 2048
  *             The length of a buffer that stores all data including ANSI escape codes and characters, etc. The default value is 2048 and you can define other value before you include the header.
  *
+ *         #define TR_MAX_STYLES 256
+ *             The number of distinct styles the style table of `TrRenderContext` can hold. The default value is 256 and you can define other value (up to 65534) before you include the header.
+ *
+ *         #define TR_MAX_GRAPHEMES 256 / #define TR_MAX_GRAPHEME_BYTES 4096
+ *             The number of grapheme clusters the grapheme pool of `TrRenderContext` can hold and the bytes they can use in total. The default values are 256 (up to 65534) and 4096 and you can define other values before you include the header.
+ *
+ *         #define TR_MAX_TEXT_PANE_ROWS 64 / #define TR_MAX_TEXT_PANE_COLS 128
+ *             The number of lines and the length of a line that `TrTextPane` keeps. The default values are 64 and 128 and you can define other values before you include the header.
+ *
+ *         #define TR_NO_THREADS
+ *             Excludes types and functions that need atomics or threads. (`TrCommandQueue`, `TrAsyncWriter`, `TrPipeline`) Define this if your compiler is not GCC, Clang or MSVC.
+ *
+ *         #define TR_MAX_COMMAND_QUEUE_LEN 256
+ *             The capacity of `TrCommandQueue`. MUST BE A POWER OF TWO. The default value is 256 and you can define other value before you include the header.
+ *
+ *         #define TR_MAX_COMMAND_TEXT_LEN 64
+ *             The length of the text stored in a `TrCommand`. The default value is 64 and you can define other value before you include the header.
+ *
+ *         #define TR_ASYNC_WRITER_BUFFER_COUNT 2
+ *             The number of frame buffers owned by `TrAsyncWriter`. 2 means double-buffering, 3 means triple-buffering. MUST BE AT LEAST 2. The default value is 2 and you can define other value before you include the header.
+ *
+ *         #define TR_LOOP_ESC_TIMEOUT_MS 25
+ *             How long `TrLoop` waits for the rest of an escape sequence before it reports a lone ESC key. The default value is 25 and you can define other value before you include the header.
+ *
  * ==========================================================================*/
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 // clang-format off
@@ -64,6 +101,9 @@ typedef enum TrResult {
     TR_ERR_BAD_ARG,
     TR_ERR_ALLOC_FAIL,
     TR_ERR_BUF_OVERFLOW, // When the length of rendering text is longer than TR_MAX_RAW_BUFFER_LEN.
+    TR_ERR_NO_TERMINAL,  // When stdout is not a terminal.
+    TR_ERR_IO,           // When reading or writing a file fails, or a file is malformed.
+    TR_ERR_UNRECORDABLE, // When a draw call cannot be written to a trace, e.g. an image too large for a record.
 } TrResult;
 
 // ============================================================================
@@ -123,6 +163,7 @@ TR_API uint8_t  tr_rgb_b(uint32_t rgb);                  // Gets `b` of a rgb va
 TR_API uint32_t tr_color_code(uint32_t color);           // Gets color code of a color.
 TR_API uint32_t tr_color_mode(uint32_t color);           // Gets color mode of a color.
 TR_API bool     tr_valid_color(uint32_t color);          // Checks if the color is valid or not.
+TR_API uint32_t tr_blend(uint32_t bottom, uint32_t top, uint8_t alpha); // Mixes two true colors. 0 is `bottom`, 255 is `top`. Other colors switch from `bottom` to `top` at 128.
 // clang-format on
 // ----------------------------------------------------------------------------
 
@@ -205,9 +246,40 @@ TR_API bool     tr_valid_color(uint32_t color);          // Checks if the color
 #define TR_TRANSPARENT 0xFF // This is not a drawable value. Use this only for `tr_ctx_XXX`.
 // ============================================================================
 
-#ifndef TR_NO_RENDERER
+// Writer
+// ============================================================================
+// Buffered version of the functions above. Output is collected in a buffer and written to stdout at once when it is full or flushed.
+// It remembers the current effects and colors, so sequences that change nothing are skipped. Do not write to stdout yourself before flushing it.
+// clang-format off
+#ifndef TR_MAX_WRITER_BUFFER_LEN
+    #define TR_MAX_WRITER_BUFFER_LEN 4096
+#endif
+// clang-format on
+typedef struct TrWriter {
+    char *buf; // `internal` or a user-supplied buffer.
+    size_t len, idx;
+    char internal[TR_MAX_WRITER_BUFFER_LEN];
+    TrEffect effects; // Current state of the terminal.
+    uint32_t fg, bg;
+} TrWriter;
+// clang-format off
+TR_API void     tr_wr_init(TrWriter *w, char *buf, size_t len);     // Uses the internal buffer if `buf` == NULL. Assumes the terminal is in the default state.
+TR_API void     tr_wr_flush(TrWriter *w);                           // Writes the buffered output to stdout.
+TR_API void     tr_wr_write(TrWriter *w, const char *text, size_t len);
+TR_API void     tr_wr_puts(TrWriter *w, const char *text);
+TR_API void     tr_wr_move_cursor(TrWriter *w, int x, int y);       // Negative params are ignored.
+TR_API void     tr_wr_show_cursor(TrWriter *w);
+TR_API void     tr_wr_hide_cursor(TrWriter *w);
+TR_API void     tr_wr_add_effects(TrWriter *w, TrEffect effects);
+TR_API void     tr_wr_remove_effects(TrWriter *w, TrEffect effects);
+TR_API void     tr_wr_reset_effects(TrWriter *w);
+TR_API void     tr_wr_reset_all(TrWriter *w);
+TR_API TrResult tr_wr_set_fg(TrWriter *w, uint32_t fg);
+TR_API TrResult tr_wr_set_bg(TrWriter *w, uint32_t bg);
+// clang-format on
+// ============================================================================
 
-#include <stddef.h>
+#ifndef TR_NO_RENDERER
 
 // Styles
 // ============================================================================
@@ -222,7 +294,8 @@ TR_API void tr_copy_style(TrStyle *dst, TrStyle src);
 
 // Cell
 // ============================================================================
-#define TR_MAX_UTF8_LEN 4 // Length of a cell's UTF8 byte sequence including \0.
+#define TR_MAX_UTF8_LEN 4      // Size of a cell's letter. UTF8 bytes padded with \0, 4 bytes without \0, or a grapheme id from `tr_ctx_intern_grapheme`.
+#define TR_MAX_GRAPHEME_LEN 32 // Longest grapheme cluster in bytes that `tr_ctx_intern_grapheme` takes.
 
 typedef struct TrCell {
     char letter[TR_MAX_UTF8_LEN];
@@ -255,6 +328,16 @@ TR_API void tr_cvec_cleanup(TrCellVector *cvec);
 typedef TrCellVector TrCellSpan; // View for `TrCell` containers. Similar to std::span in C++.
 // ============================================================================
 
+// Transform
+// ============================================================================
+typedef struct TrTransform { // Flips are applied first, then rotation, then scaling.
+    bool flip_h, flip_v;
+    int rotation; // Clockwise in degrees. One of 0, 90, 180, 270.
+    int scale;    // Integer scale factor. Each cell is repeated `scale` x `scale` times.
+} TrTransform;
+TR_API TrTransform tr_default_transform(void);
+// ============================================================================
+
 // Basic renderer
 // ============================================================================
 // clang-format off
@@ -281,11 +364,37 @@ TR_API TrResult tr_strcat_set_fg(char *dst, size_t len, size_t *idx, uint32_t fg
 TR_API TrResult tr_strcat_set_bg(char *dst, size_t len, size_t *idx, uint32_t bg); // Appends a string that set bg color to dst.
 // ----------------------------------------------------------------------------
 
+// Encoder
+// ----------------------------------------------------------------------------
+// A deployment usually targets one kind of terminal. An encoder is picked once for it, so the per-cell path does not validate colors or switch on color modes.
+typedef TrResult (*TrColorEncoder)(char *dst, size_t len, size_t *idx, uint32_t color);                     // Appends a string that sets a color to dst. TR_TRANSPARENT is never passed.
+typedef TrResult (*TrEffectsEncoder)(char *dst, size_t len, size_t *idx, TrEffect removed, TrEffect added); // Appends a string that removes, then adds effects to dst.
+// clang-format off
+#define TR_CAP_REP (1 << 0) // "\x1b[<n>b" repeats the last character. Supported by xterm, VTE based terminals (e.g. GNOME Terminal), kitty, foot and WezTerm, but not by every terminal.
+#define TR_CAP_ECH (1 << 1) // "\x1b[<n>X" erases characters with the current background. Supported by almost every VT220 compatible terminal.
+// clang-format on
+typedef struct TrEncoder {
+    TrColorEncoder set_fg, set_bg;
+    TrEffectsEncoder set_effects;
+    uint32_t caps; // TR_CAP_XXX the terminal supports. Runs of identical cells are written with them when it is shorter. Built-in encoders have none. Use `tr_ctx_set_caps`.
+} TrEncoder;
+// clang-format off
+typedef enum TrEncoderColors {
+    TR_ENCODER_GENERIC = 0, // Keeps the color mode of each color and validates it, like `tr_strcat_set_fg`.
+    TR_ENCODER_TRUE_COLOR,  // Writes every color as a 24-bit color.
+    TR_ENCODER_256,         // Writes every color as an ANSI 256 color. True colors are mapped to the nearest one.
+    TR_ENCODER_16,          // Writes every color as an ANSI 16 color. Other colors are mapped to the nearest one.
+} TrEncoderColors;
+// clang-format on
+TR_API TrEncoder tr_encoder(TrEncoderColors colors, bool effects); // Returns a built-in encoder. Effects are dropped if `effects` is false. Only TR_ENCODER_GENERIC validates colors.
+// ----------------------------------------------------------------------------
+
 // Rendering functions
 // ----------------------------------------------------------------------------
 TR_API TrResult tr_draw_sprite(TrCellSpan sprite, int x, int y);                                              // Draws a sprite on the screen.
 TR_API TrResult tr_draw_spritesheet(TrCellSpan ss, int spr_x, int spr_y, int spr_w, int spr_h, int x, int y); // Draws a sprite from a spritesheet on the screen.
 TR_API TrResult tr_draw_text(const char *text, TrStyle style, int x, int y);                                  // Draws a string on the screen.
+TR_API TrResult tr_strcat_sprite(char *dst, size_t len, size_t *idx, TrCellSpan sprite, int x, int y, TrEncoder encoder); // Appends a string that draws a sprite to dst.
 // ----------------------------------------------------------------------------
 // ============================================================================
 
@@ -300,20 +409,366 @@ typedef struct TrFramebufferBase { // Data set for a framebuffer.
     char letter[TR_MAX_FRAMEBUFFER_LEN][TR_MAX_UTF8_LEN];
     TrEffect effects[TR_MAX_FRAMEBUFFER_LEN];
     uint32_t fg[TR_MAX_FRAMEBUFFER_LEN], bg[TR_MAX_FRAMEBUFFER_LEN];
+    uint16_t *style; // Style id of each cell. Only allocated while the style table is enabled, NULL otherwise.
 } TrFramebufferBase;
 
+// clang-format off
+#ifndef TR_MAX_STYLES
+    #define TR_MAX_STYLES 256
+#endif
+// clang-format on
+typedef struct TrStyleTable { // Interned (effects, fg, bg) triples and their preformatted color codes.
+    TrStyle styles[TR_MAX_STYLES];
+    char fg_ansi[TR_MAX_STYLES][24], bg_ansi[TR_MAX_STYLES][24];
+    uint8_t fg_len[TR_MAX_STYLES], bg_len[TR_MAX_STYLES]; // 0 if the color can not be printed.
+    uint16_t slots[TR_MAX_STYLES * 2];                    // Open addressing hash table of ids + 1. 0 means empty.
+    int count;
+    bool overflow; // A style did not fit. Cells are compared by their colors until the next rebuild.
+} TrStyleTable;
+
+// clang-format off
+#ifndef TR_MAX_GRAPHEMES
+    #define TR_MAX_GRAPHEMES 256
+#endif
+#ifndef TR_MAX_GRAPHEME_BYTES
+    #define TR_MAX_GRAPHEME_BYTES 4096
+#endif
+#if TR_MAX_GRAPHEMES > 65534
+    #error "TR_MAX_GRAPHEMES must be 65534 or less."
+#endif
+// clang-format on
+typedef struct TrGraphemePool { // Interned grapheme clusters that do not fit in a letter. Letters refer to them by id, so cells stay 4 bytes.
+    char bytes[TR_MAX_GRAPHEME_BYTES];
+    uint32_t offset[TR_MAX_GRAPHEMES]; // Where each cluster starts in `bytes`.
+    uint8_t len[TR_MAX_GRAPHEMES];
+    uint16_t slots[TR_MAX_GRAPHEMES * 2]; // Open addressing hash table of ids + 1. 0 means empty.
+    int count;
+    size_t used; // Bytes of `bytes` in use.
+} TrGraphemePool;
+
+#ifndef TR_NO_THREADS
+struct TrAsyncWriter;
+struct TrPipeline;
+#endif
+struct TrRecorder;
+
+typedef struct TrRenderStats { // Filled by `tr_ctx_render`.
+    size_t bytes;             // Bytes written or queued by the last render.
+    uint32_t cells;           // Cells drawn by the last render.
+    uint32_t dirty, spans;    // Cells in dirty spans and the number of those spans in the last render.
+    bool full_redraw;         // The last render drew every cell instead of dirty spans, because most of the screen was changing.
+    bool coalesced;           // The output had not drained, so the last render replaced the newest queued frame and carries its damage too. If that frame was of another context, the render was skipped and its damage is sent by the next render.
+    uint32_t coalesced_count; // Total number of coalesced renders.
+} TrRenderStats;
+
+typedef struct TrTerminalState { // What the terminal is left in by the last render, so the next one continues from it if nothing else wrote to the terminal since.
+    TrStyle style;
+    int cursor_x, cursor_y;
+    bool known; // If false, the next render resets the style and moves the cursor first.
+} TrTerminalState;
+
+typedef struct TrViewport { // A region of a context with its own origin. Panes share the context's framebuffers, diff and render.
+    int x, y;                           // Origin in the context. `tr_ctx_draw_XXX` at (0, 0) draws here.
+    int clip_x, clip_y, clip_w, clip_h; // Cells of the context outside of this rectangle are not drawn.
+} TrViewport;
+
 typedef struct TrRenderContext { // Render context for double-buffering. It holds two framebuffers.
     TrFramebufferBase front, back;
     int x, y;
     int width, height;
+    TrRenderStats stats;
+    int tolerance;                        // Color differences below this are not redrawn. Use `tr_ctx_set_tolerance`.
+    int scroll_y, scroll_h, scroll_n;     // Terminal scroll requested by `tr_ctx_scroll`, emitted by the next render. `scroll_n` == 0 means none.
+    bool lazy_clear;                      // `tr_ctx_clear` only bumps `clear_gen`. Use `tr_ctx_set_lazy_clear`.
+    bool style_table;                     // Cells carry style ids from `styles`. Use `tr_ctx_set_style_table`.
+    TrStyleTable *styles;                 // Allocated with the style ids of both framebuffers while the style table is enabled, NULL otherwise.
+    TrGraphemePool *graphemes;            // Clusters that letters of the framebuffers refer to. Allocated by the first `tr_ctx_intern_grapheme` that needs it, NULL before.
+    TrEncoder encoder;                    // Use `tr_ctx_set_encoder`.
+    TrTerminalState term;                 // Style and cursor are not reset after each render. Use `tr_ctx_forget_terminal` and `tr_ctx_reset_terminal`.
+    uint32_t clear_gen, clear_bg;         // Generation and background color of the last clear.
+    uint32_t gen[TR_MAX_FRAMEBUFFER_LEN]; // Generation in which each cell of `back` was last written. Cells older than `clear_gen` read as cleared.
+    uint32_t span_list[TR_MAX_FRAMEBUFFER_LEN * 2]; // First and past-the-end cell of each dirty span found by a render, so it searches them once.
+    bool headless;                        // Renders write nothing. Use `tr_ctx_set_headless`.
+    TrViewport viewport;                  // Where `tr_ctx_draw_XXX` draws. Use `tr_ctx_set_viewport`.
+    struct TrRecorder *recorder;          // Draw calls are recorded to it when not NULL. Use `tr_rec_open`.
+#ifndef TR_NO_THREADS
+    struct TrAsyncWriter *writer; // Output goes to stdout directly when NULL. Use `tr_ctx_set_writer`.
+    struct TrPipeline *pipeline;  // `tr_ctx_submit` renders on it when not NULL. Use `tr_ctx_set_pipeline`.
+#endif
 } TrRenderContext;
+
+TR_API TrViewport tr_viewport(int x, int y, int width, int height);                            // A viewport whose origin is the top-left of its clip rectangle.
+TR_API TrViewport tr_viewport_sub(TrViewport parent, int x, int y, int width, int height);     // A viewport at (x, y) of `parent`, clipped to `parent` too. For nested panes.
+
+typedef struct TrSpriteInstance { // A sprite and where to draw it. Used by `tr_ctx_draw_sprite_batch`.
+    TrCellSpan sprite;
+    int x, y;
+} TrSpriteInstance;
+
+typedef struct TrShadeRow { // Visible cells of a row passed to a `TrShader`. Planes point into `ctx.back` and hold what was drawn before.
+    int x, y;  // Position of the first cell in the coordinates given to `tr_ctx_shade`.
+    int width; // Number of cells in each plane.
+    char (*letter)[TR_MAX_UTF8_LEN];
+    TrEffect *effects;
+    uint32_t *fg, *bg;
+} TrShadeRow;
+typedef void (*TrShader)(const TrShadeRow *row, void *user); // Writes any of the planes of `row`. Colors must be valid and not TR_TRANSPARENT.
 // clang-format off
 TR_API TrResult tr_ctx_init(TrRenderContext *ctx, int x, int y, int width, int height);
 TR_API void     tr_ctx_clear(TrRenderContext *ctx, uint32_t bg);                                                   // Clears `ctx.back`.
-TR_API TrResult tr_ctx_render(TrRenderContext *ctx);                                                               // Renders the result using dirty rectangles.
+TR_API void     tr_ctx_set_tolerance(TrRenderContext *ctx, int tolerance);                                         // Lossy mode. A cell whose true colors differ from the screen by less than `tolerance` (redmean distance, 0..765) counts as unchanged. 0 disables it.
+TR_API void     tr_ctx_set_encoder(TrRenderContext *ctx, TrEncoder encoder);                                        // Chooses how styles are written. The default is `tr_encoder(TR_ENCODER_GENERIC, true)`.
+TR_API void     tr_ctx_set_caps(TrRenderContext *ctx, uint32_t caps);                                              // Sets TR_CAP_XXX of the encoder of `ctx`, so runs of identical cells are written shorter. Only set what the terminal supports. 0 disables them.
+TR_API TrResult tr_ctx_set_style_table(TrRenderContext *ctx, bool enabled);                                        // Interns styles of cells, so diffs compare a letter and a 16-bit id per cell and color codes are formatted once per style. Do not write to `ctx.back` directly while it is enabled. Enabling allocates the table and the ids with TR_MALLOC, and disabling frees them, so disable it before the context goes away.
+TR_API void     tr_ctx_set_lazy_clear(TrRenderContext *ctx, bool enabled);                                         // Makes `tr_ctx_clear` O(1). Cells that are not drawn after a clear are cleared by `tr_ctx_render`. Do not write to `ctx.back` directly while it is enabled.
+TR_API void     tr_ctx_set_viewport(TrRenderContext *ctx, TrViewport viewport);                                    // Makes `tr_ctx_draw_XXX` draw relative to the origin of `viewport` and clips them to it. The clip rectangle is cut to the context. Other calls still use the coordinates of the context.
+TR_API void     tr_ctx_reset_viewport(TrRenderContext *ctx);                                                       // Draws on the whole context again.
+TR_API TrResult tr_ctx_intern_grapheme(TrRenderContext *ctx, const char *text, size_t len, char *letter);           // Writes a grapheme cluster, e.g. an emoji with modifiers or a letter with combining marks, into the letter of a cell of `ctx`. Up to 4 bytes are kept inline, longer ones are interned. A wide one covers the cell on its right, which should hold an empty letter. Returns TR_ERR_BUF_OVERFLOW if the pool is full. The pool is allocated with TR_MALLOC by the first cluster that does not fit.
+TR_API void     tr_ctx_reset_graphemes(TrRenderContext *ctx);                                                      // Frees the grapheme pool and invalidates the context. Letters interned before must be interned and drawn again. Call it before the context goes away if clusters were interned.
+TR_API TrResult tr_ctx_resize(TrRenderContext *ctx, int width, int height);                                         // Resets the viewport and resizes in place. Overlapping cells are kept and only new cells are drawn by the next render. Call `tr_ctx_invalidate_all` too if the terminal reflowed or cleared the screen.
+TR_API void     tr_ctx_invalidate(TrRenderContext *ctx, int x, int y, int width, int height);                      // Marks an area of the screen as unknown, e.g. after another program wrote there. The next render redraws exactly those cells.
+TR_API void     tr_ctx_invalidate_all(TrRenderContext *ctx);                                                       // Same as `tr_ctx_invalidate` over the whole context.
+TR_API void     tr_ctx_forget_terminal(TrRenderContext *ctx);                                                      // Call after writing to the terminal other than with `tr_XXX` or another context, e.g. with printf. The next render starts with a reset instead of the style it left. Writes of other contexts and `tr_XXX` are noticed without it.
+TR_API void     tr_ctx_set_headless(TrRenderContext *ctx, bool enabled);                                           // Renders still encode frames and fill `ctx.stats`, but write nothing. For replays and benchmarks.
+TR_API void     tr_ctx_reset_terminal(TrRenderContext *ctx);                                                       // Resets the style left by renders. Call before exiting or handing the terminal to other code.
+TR_API TrResult tr_ctx_render(TrRenderContext *ctx);                                                               // Renders the result using dirty spans of each row, or the whole frame when that is estimated to be shorter. With a writer, skips the frame while the output is not drained.
+TR_API TrResult tr_ctx_submit(TrRenderContext *ctx);                                                               // Same as `tr_ctx_render`, but with a pipeline it hands `ctx.back` over and returns without waiting for the render. It then returns the result of the last frame the pipeline finished, and `ctx.stats` describes that frame.
+TR_API TrResult tr_ctx_scroll(TrRenderContext *ctx, int y, int height, int n);                                      // Scrolls rows [y, y + height) of the screen up by `n` in the next render, so rows that moved are not redrawn. Whole terminal rows scroll, so the context must span the full terminal width. One region per frame.
 TR_API TrResult tr_ctx_draw_rect(TrRenderContext *ctx, int x, int y, int width, int height, uint32_t color);       // Draws a rectangle on `ctx.back`.
 TR_API TrResult tr_ctx_draw_sprite(TrRenderContext *ctx, TrCellSpan sprite, int x, int y);                         // Draws a sprite on `ctx.back`.
+TR_API TrResult tr_ctx_draw_sprite_batch(TrRenderContext *ctx, const TrSpriteInstance *instances, size_t count);   // Same result as `tr_ctx_draw_sprite` for each instance in order, but faster for many small sprites like particles. Returns TR_ERR_BAD_ARG if a sprite is empty, but still draws the others.
+TR_API TrResult tr_ctx_draw_sprite_transformed(TrRenderContext *ctx, TrCellSpan sprite, int x, int y, TrTransform transform); // Draws a flipped, rotated or scaled sprite on `ctx.back`. (x, y) is the top-left of the result.
+TR_API TrResult tr_ctx_draw_sprite_blended(TrRenderContext *ctx, TrCellSpan sprite, int x, int y, uint8_t opacity);   // Draws a translucent sprite on `ctx.back`. fg and bg are blended with the bg below using `tr_blend`.
+TR_API TrResult tr_ctx_draw_rect_blended(TrRenderContext *ctx, int x, int y, int width, int height, uint32_t color, uint8_t opacity); // Tints the cells below with `color`. Letters are kept.
+TR_API TrResult tr_ctx_draw_image(TrRenderContext *ctx, const uint8_t *pixels, int img_w, int img_h, int channels, int x, int y, int width, int height); // Draws packed RGB(`channels` == 3) or RGBA(4) pixels into `width` x `height` cells, two pixels per cell with half blocks. The image is box-filtered to fit. Needs unicode.
 TR_API TrResult tr_ctx_draw_text(TrRenderContext *ctx, const char *text, size_t len, TrStyle style, int x, int y); // Draws a string on `ctx.back`. Only single-byte ASCII characters supported.
+TR_API TrResult tr_ctx_draw_hline(TrRenderContext *ctx, int x, int y, int len, const char *letter, TrStyle style);  // Draws a horizontal line of `letter` on `ctx.back`. TR_TRANSPARENT fg or bg keeps the colors below. `letter` is a string of up to 4 bytes or a letter from `tr_ctx_intern_grapheme`.
+TR_API TrResult tr_ctx_draw_vline(TrRenderContext *ctx, int x, int y, int len, const char *letter, TrStyle style);  // Draws a vertical line of `letter` on `ctx.back`. TR_TRANSPARENT fg or bg keeps the colors below. `letter` is a string of up to 4 bytes or a letter from `tr_ctx_intern_grapheme`.
+TR_API TrResult tr_ctx_shade(TrRenderContext *ctx, int x, int y, int width, int height, TrShader shader, void *user, int threads); // Calls `shader` once per visible row of a rectangle of `ctx.back`, for procedural backgrounds. Rows are split between `threads` threads if it is more than 1, so `shader` must be thread-safe then. The threads are started and joined by each call, so only pass more than 1 for large fills that outweigh that, e.g. a full-screen background. `threads` is ignored with TR_NO_THREADS.
+// clang-format on
+// ============================================================================
+
+// Text pane
+// ============================================================================
+// Scrolling log view. Lines are kept in a ring, so appending a line is O(line length) no matter how many lines are kept.
+// clang-format off
+#ifndef TR_MAX_TEXT_PANE_ROWS
+    #define TR_MAX_TEXT_PANE_ROWS 64
+#endif
+#ifndef TR_MAX_TEXT_PANE_COLS
+    #define TR_MAX_TEXT_PANE_COLS 128
+#endif
+// clang-format on
+typedef struct TrTextPane {
+    char text[TR_MAX_TEXT_PANE_ROWS][TR_MAX_TEXT_PANE_COLS];
+    size_t len[TR_MAX_TEXT_PANE_ROWS];
+    TrStyle style[TR_MAX_TEXT_PANE_ROWS];
+    int head, count;      // Ring index of the oldest line and the number of lines.
+    int appended;         // Lines appended since the last draw.
+    int drawn_count;      // `count` at the last draw.
+    bool terminal_scroll; // Use `tr_ctx_scroll` for new lines. Use `tr_tpane_set_terminal_scroll`.
+} TrTextPane;
+// clang-format off
+TR_API void     tr_tpane_init(TrTextPane *pane);
+TR_API void     tr_tpane_set_terminal_scroll(TrTextPane *pane, bool enabled);                                  // Only enable this if the pane covers full rows of a context that spans the full terminal width.
+TR_API void     tr_tpane_append(TrTextPane *pane, const char *text, size_t len, TrStyle style);                // Adds a line. The oldest line is dropped when full. Only the first TR_MAX_TEXT_PANE_COLS bytes are kept.
+TR_API TrResult tr_tpane_draw(TrTextPane *pane, TrRenderContext *ctx, int x, int y, int width, int height); // Draws the last `height` lines on `ctx.back`.
+// clang-format on
+// ============================================================================
+
+#ifndef TR_NO_THREADS
+// Async writer
+// ============================================================================
+// Background thread that writes rendered frames to stdout, so `tr_ctx_render` returns as soon as the frame is encoded.
+// Frames are written in order. Flush it with `tr_aw_flush` before writing to stdout yourself.
+// While every buffer is busy, `tr_ctx_render` replaces the newest queued frame of the context with one that also carries its damage, so latency stays bounded and the latest frame is always written.
+// Only when that frame belongs to another context sharing the writer is the render skipped, and its damage goes with the next render.
+// clang-format off
+#ifndef TR_ASYNC_WRITER_BUFFER_COUNT
+    #define TR_ASYNC_WRITER_BUFFER_COUNT 2
+#endif
+#if TR_ASYNC_WRITER_BUFFER_COUNT < 2
+    #error "TR_ASYNC_WRITER_BUFFER_COUNT must be at least 2."
+#endif
+// clang-format on
+typedef struct TrAsyncWriter {
+    void *priv; // Buffers and the thread. Allocated with TR_MALLOC.
+} TrAsyncWriter;
+// clang-format off
+TR_API TrResult tr_aw_init(TrAsyncWriter *aw);                                  // Allocates the buffers and starts the thread.
+TR_API void     tr_aw_cleanup(TrAsyncWriter *aw);                               // Writes the remaining frames, stops the thread and frees the buffers.
+TR_API void     tr_aw_flush(TrAsyncWriter *aw);                                 // Waits until every submitted frame is written.
+TR_API void     tr_ctx_set_writer(TrRenderContext *ctx, TrAsyncWriter *writer); // `tr_ctx_render` hands frames to `writer` and coalesces them into the newest queued frame while all buffers are busy. Pass NULL to write synchronously again.
+// clang-format on
+// ============================================================================
+
+// Render pipeline
+// ============================================================================
+// Background thread that diffs, encodes and writes frames, so the next frame is drawn while the last one is rendered. Frame time becomes the longer of the two instead of their sum.
+// It renders with its own `front`, terminal state and style table. It has two frames: `tr_ctx_submit` copies `ctx.back` into one while the thread renders the other, and returns, so `ctx.back` can be drawn again right away. It only waits when both frames are busy.
+// No frame is skipped, unless a writer is set too. Settings, resizes, scrolls and invalidations of `ctx` are forwarded with the next submitted frame.
+typedef struct TrPipeline {
+    void *priv; // The render context of the thread and the thread itself. Allocated with TR_MALLOC.
+} TrPipeline;
+// clang-format off
+TR_API TrResult tr_pipe_init(TrPipeline *pipe);                              // Allocates the render context and starts the thread.
+TR_API void     tr_pipe_cleanup(TrPipeline *pipe);                           // Renders the submitted frame and stops the thread. Unset it from its context first.
+TR_API void     tr_pipe_flush(TrPipeline *pipe);                             // Waits until the submitted frame is rendered.
+TR_API void     tr_ctx_set_pipeline(TrRenderContext *ctx, TrPipeline *pipe); // `tr_ctx_submit` renders frames of `ctx` on `pipe`. Do not call `tr_ctx_render` while it is set. Pass NULL to render on this thread again. One pipeline serves one context.
+// clang-format on
+// ============================================================================
+
+// Command queue
+// ============================================================================
+// Bounded lock-free queue that lets other threads submit draw commands. Any number of threads can push, but only the thread that owns the `TrRenderContext` can drain.
+// clang-format off
+#ifndef TR_MAX_COMMAND_QUEUE_LEN
+    #define TR_MAX_COMMAND_QUEUE_LEN 256
+#endif
+#ifndef TR_MAX_COMMAND_TEXT_LEN
+    #define TR_MAX_COMMAND_TEXT_LEN 64
+#endif
+#if (TR_MAX_COMMAND_QUEUE_LEN & (TR_MAX_COMMAND_QUEUE_LEN - 1)) != 0
+    #error "TR_MAX_COMMAND_QUEUE_LEN must be a power of two."
+#endif
+// clang-format on
+typedef enum TrCommandType {
+    TR_CMD_CLEAR,
+    TR_CMD_RECT,
+    TR_CMD_SPRITE,
+    TR_CMD_TEXT,
+} TrCommandType;
+
+typedef struct TrCommand { // Fixed-size record of a `tr_ctx_XXX` call. Only the members used by `type` are meaningful.
+    TrCommandType type;
+    int x, y, width, height;
+    uint32_t color;    // TR_CMD_CLEAR, TR_CMD_RECT
+    TrCellSpan sprite; // TR_CMD_SPRITE. Only the view is copied, so the cells must stay alive until the command is drained.
+    TrStyle style;     // TR_CMD_TEXT
+    size_t text_len;   // TR_CMD_TEXT
+    char text[TR_MAX_COMMAND_TEXT_LEN];
+} TrCommand;
+
+typedef struct TrCommandQueue {
+    TrCommand cmds[TR_MAX_COMMAND_QUEUE_LEN];
+    uint32_t seq[TR_MAX_COMMAND_QUEUE_LEN]; // Sequence number of each slot. Tells producers and the consumer whose turn it is.
+    uint32_t head, tail;                    // `head` is only touched by the consumer, `tail` is shared by producers.
+} TrCommandQueue;
+// clang-format off
+TR_API void     tr_cmdq_init(TrCommandQueue *q);                                                                        // NOT thread-safe. Call it before sharing the queue.
+TR_API TrResult tr_cmdq_push(TrCommandQueue *q, const TrCommand *cmd);                                                  // Never blocks. Returns TR_ERR_BUF_OVERFLOW when the queue is full.
+TR_API TrResult tr_cmdq_push_clear(TrCommandQueue *q, uint32_t bg);                                                     // Queues `tr_ctx_clear`.
+TR_API TrResult tr_cmdq_push_rect(TrCommandQueue *q, int x, int y, int width, int height, uint32_t color);              // Queues `tr_ctx_draw_rect`.
+TR_API TrResult tr_cmdq_push_sprite(TrCommandQueue *q, TrCellSpan sprite, int x, int y);                                // Queues `tr_ctx_draw_sprite`.
+TR_API TrResult tr_cmdq_push_text(TrCommandQueue *q, const char *text, size_t len, TrStyle style, int x, int y);       // Queues `tr_ctx_draw_text`. Returns TR_ERR_BAD_ARG when `len` > TR_MAX_COMMAND_TEXT_LEN.
+TR_API TrResult tr_cmdq_drain(TrCommandQueue *q, TrRenderContext *ctx);                                                 // Runs the commands queued before the call on `ctx.back`. Only one thread may drain. Returns the first error, but drains all of them.
+// clang-format on
+// ============================================================================
+#endif // TR_NO_THREADS
+
+// Event loop
+// ============================================================================
+// Blocks on stdin until input arrives or the next frame is due, so an idle loop uses no CPU and input is handled as soon as it arrives.
+// Keys and escape sequences are decoded into `TrEvent`s. Terminal resizes are reported as events too.
+// clang-format off
+#ifndef TR_LOOP_ESC_TIMEOUT_MS
+    #define TR_LOOP_ESC_TIMEOUT_MS 25
+#endif
+// clang-format on
+enum { // Values of `TrEvent.key` that are not characters. Other keys are their unicode code point, control keys are their byte. (e.g. 'a', 13 for Enter)
+    TR_KEY_NONE = 0,
+    TR_KEY_TAB = 9,
+    TR_KEY_ENTER = 13,
+    TR_KEY_ESC = 27,
+    TR_KEY_BACKSPACE = 127,
+    TR_KEY_UP = 0x110000, // Above every code point.
+    TR_KEY_DOWN,
+    TR_KEY_RIGHT,
+    TR_KEY_LEFT,
+    TR_KEY_HOME,
+    TR_KEY_END,
+    TR_KEY_INSERT,
+    TR_KEY_DELETE,
+    TR_KEY_PAGE_UP,
+    TR_KEY_PAGE_DOWN,
+    TR_KEY_BACKTAB,
+    TR_KEY_F1, // TR_KEY_F1 + n is F(n + 1) up to F12.
+};
+
+enum {
+    TR_MOD_SHIFT = 1 << 0,
+    TR_MOD_ALT = 1 << 1,
+    TR_MOD_CTRL = 1 << 2,
+};
+
+typedef enum TrEventType {
+    TR_EVENT_KEY,
+    TR_EVENT_RESIZE,
+    TR_EVENT_EOF, // stdin reached its end, e.g. a pipe was closed. Reported once.
+} TrEventType;
+
+typedef struct TrEvent {
+    TrEventType type;
+    int key;                        // TR_EVENT_KEY
+    uint8_t mods;                   // TR_EVENT_KEY. TR_MOD_XXX bits, only known for special keys and ALT.
+    char text[TR_MAX_UTF8_LEN + 1]; // TR_EVENT_KEY. UTF-8 of a character key, empty for the others. Always NUL-terminated.
+    int width, height;              // TR_EVENT_RESIZE. New size of the terminal.
+} TrEvent;
+
+typedef struct TrLoop TrLoop;
+typedef void (*TrEventFunc)(TrLoop *loop, const TrEvent *event);
+typedef void (*TrFrameFunc)(TrLoop *loop, double dt); // Updates, draws and renders a frame. `dt` is the seconds since the last frame.
+
+struct TrLoop {
+    TrEventFunc on_event; // Can be NULL.
+    TrFrameFunc on_frame;
+    void *user;           // Free to use.
+    int fps;              // Frames per second. 0 draws a frame only after an event or `tr_loop_damage`.
+    bool running, damaged;
+    bool input_closed;         // stdin reached its end, so only frames and resizes are waited for.
+    char input[32];            // Bytes read, but not decoded yet.
+    size_t input_len;
+    double last_frame, next_frame; // In seconds of a monotonic clock.
+};
+// clang-format off
+TR_API void     tr_loop_init(TrLoop *loop, int fps, TrEventFunc on_event, TrFrameFunc on_frame, void *user);
+TR_API TrResult tr_loop_run(TrLoop *loop);   // Turns off echo and line buffering of stdin and calls the callbacks until `tr_loop_stop`. The first frame is drawn at once. Restores stdin before it returns. With `fps` == 0, it also returns after TR_EVENT_EOF, since nothing but a resize could wake it.
+TR_API void     tr_loop_stop(TrLoop *loop);  // Call from the callbacks. The loop returns after the current callback.
+TR_API void     tr_loop_damage(TrLoop *loop); // Asks for a frame when `fps` == 0. Call from the callbacks.
+TR_API size_t   tr_decode_key(const char *buf, size_t len, bool final, TrEvent *event); // Decodes the first key of `buf`. Returns the bytes used, or 0 if `buf` may be the start of a longer sequence and `final` == false. Unknown sequences are used up with TR_KEY_NONE.
+// clang-format on
+// ============================================================================
+
+// Recording
+// ============================================================================
+// Records the draw calls of a `TrRenderContext` into a compact binary trace, so a session can be replayed headless to reproduce and profile it.
+// Recorded: `tr_ctx_clear`, `tr_ctx_set_viewport`, `tr_ctx_render`, every `tr_ctx_draw_XXX`, and the calls that change what later renders write: `tr_ctx_scroll`, `tr_ctx_invalidate`, `tr_ctx_resize`, `tr_ctx_forget_terminal`, `tr_ctx_reset_graphemes` and the `tr_ctx_set_XXX` modes of rendering.
+// Output settings (`tr_ctx_set_headless`, `tr_ctx_set_writer`, `tr_ctx_set_pipeline`) are not, since a replay chooses its own. A call that cannot be written sets TR_ERR_UNRECORDABLE, e.g. a custom encoder, so a trace never replays differently without telling.
+typedef struct TrRecorder {
+    void *file;      // FILE *
+    TrResult error;  // The first write error, or TR_ERR_UNRECORDABLE. Nothing is written after it.
+    uint32_t frames; // Renders recorded so far.
+} TrRecorder;
+
+typedef struct TrReplayer {
+    void *file;              // FILE *
+    int x, y, width, height; // Of the recorded context. Init the context to replay with them.
+    uint32_t frames;         // Frames replayed so far.
+    double frame_ms;         // Time the calls of the last frame took, its render included. Reading the trace is not counted.
+    TrResult render_result;  // What the render of the last frame returned.
+    TrCellVector sprite;     // Cells of the last replayed sprite.
+    size_t sprite_cap;
+    char *text;              // Text of the last replayed `tr_ctx_draw_text`.
+    size_t text_cap;
+    uint8_t *pixels;         // Pixels of the last replayed `tr_ctx_draw_image`.
+    size_t pixels_cap;
+} TrReplayer;
+// clang-format off
+TR_API TrResult tr_rec_open(TrRecorder *rec, const char *path, TrRenderContext *ctx);  // Creates the trace and starts recording `ctx`.
+TR_API TrResult tr_rec_close(TrRecorder *rec, TrRenderContext *ctx);                   // Stops recording and closes the trace. Returns the first error while recording.
+TR_API TrResult tr_replay_open(TrReplayer *rp, const char *path);                       // Opens a trace and reads the size of the recorded context.
+TR_API TrResult tr_replay_frame(TrReplayer *rp, TrRenderContext *ctx, bool *done);      // Replays the calls of the next frame up to its render. Sets `done` at the end of the trace. Results of replayed draw calls are ignored.
+TR_API void     tr_replay_close(TrReplayer *rp);
 // clang-format on
 // ============================================================================
 
@@ -332,7 +787,9 @@ TR_API void tr_fill_buf(TrCellSpan buf, uint32_t bg); // Fill the buffers with d
 
 // Terminal
 // ----------------------------------------------------------------------------
-TR_API void tr_init(bool unicode); // Flushes old buffers and setup unicode if `unicode` == true.
+TR_API void     tr_init(bool unicode);                         // Flushes old buffers and setup unicode if `unicode` == true.
+TR_API TrResult tr_get_terminal_size(int *width, int *height); // Gets the size of the terminal in cells.
+TR_API bool     tr_poll_resize(int *width, int *height);       // Returns true once after the terminal was resized, with the new size. Resizes between two calls count as one, so call it once per frame. The first call starts watching and returns false. On POSIX, it installs a SIGWINCH handler for the whole process that still calls the handler installed before it.
 // ----------------------------------------------------------------------------
 // ============================================================================
 #endif // TR_NO_RENDERER
@@ -348,15 +805,24 @@ TR_API void tr_init(bool unicode); // Flushes old buffers and setup unicode if `
 #include <stdio.h>
 #include <string.h>
 
+static const void *tr_priv_term_owner = NULL; // Context whose render wrote to the terminal last, or NULL if anything else did. Global, since there is one terminal.
+
+static void tr_priv_term_written(const void *owner) { // Called by everything that sets the style or moves the cursor, so renders of other contexts start with a reset.
+    tr_priv_term_owner = owner;
+}
+
 // Screen & Window control
 // ============================================================================
 TR_API void tr_clear(void) {
+    tr_priv_term_written(NULL);
     fputs("\x1b[2J\x1b[H", stdout);
 }
 TR_API void tr_open_alt(void) {
+    tr_priv_term_written(NULL);
     fputs("\x1b[?1049h", stdout);
 }
 TR_API void tr_close_alt(void) {
+    tr_priv_term_written(NULL);
     fputs("\x1b[?1049l", stdout);
 }
 // ============================================================================
@@ -367,6 +833,7 @@ TR_API void tr_move_cursor(int x, int y) {
     if (x < 0 || y < 0)
         return;
 
+    tr_priv_term_written(NULL);
     printf("\x1b[%d;%dH", y + 1, x + 1);
 }
 TR_API void tr_show_cursor(void) {
@@ -413,12 +880,14 @@ TR_API void tr_add_effects(TrEffect effects) {
         tr_reset_effects();
         return;
     }
+    tr_priv_term_written(NULL);
     for (int i = 0; i < TR_EFFECTS_LEN; i += 1) {
         if (effects & (1 << i))
             fputs(tr_priv_effects_ansi[TR_PRIV_ADD_EFFECTS_IDX + i], stdout);
     }
 }
 TR_API void tr_remove_effects(TrEffect effects) {
+    tr_priv_term_written(NULL);
     for (int i = 0; i < TR_EFFECTS_LEN; i += 1) {
         if (effects & (1 << i)) {
             fputs(tr_priv_effects_ansi[TR_PRIV_REMOVE_EFFECTS_IDX + i], stdout);
@@ -426,9 +895,11 @@ TR_API void tr_remove_effects(TrEffect effects) {
     }
 }
 TR_API void tr_reset_effects(void) {
+    tr_priv_term_written(NULL);
     fputs(tr_priv_effects_ansi[TR_PRIV_RESET_EFFECTS_IDX], stdout);
 }
 TR_API void tr_reset_all(void) {
+    tr_priv_term_written(NULL);
     fputs(tr_priv_effects_ansi[TR_PRIV_RESET_ALL_IDX], stdout);
 }
 // ============================================================================
@@ -451,6 +922,7 @@ TR_API TrResult tr_set_fg(uint32_t fg) {
     if (fg == TR_TRANSPARENT || !tr_valid_color(fg))
         return TR_ERR_BAD_ARG;
 
+    tr_priv_term_written(NULL);
     uint32_t mode = tr_color_mode(fg);
 
     switch (mode) {
@@ -469,6 +941,7 @@ TR_API TrResult tr_set_bg(uint32_t bg) {
     if (bg == TR_TRANSPARENT || !tr_valid_color(bg))
         return TR_ERR_BAD_ARG;
 
+    tr_priv_term_written(NULL);
     uint32_t mode = tr_color_mode(bg);
 
     switch (mode) {
@@ -518,6 +991,16 @@ TR_API uint32_t tr_color_code(uint32_t color) {
 TR_API uint32_t tr_color_mode(uint32_t color) {
     return (color >> 24) & 0xFF;
 }
+TR_API uint32_t tr_blend(uint32_t bottom, uint32_t top, uint8_t alpha) {
+    if (tr_color_mode(bottom) != TR_COLOR_TRUE || tr_color_mode(top) != TR_COLOR_TRUE)
+        return alpha >= 128 ? top : bottom;
+
+    uint32_t a = (uint32_t)alpha + (alpha >> 7); // 0..256, so 255 gives exactly `top`.
+    uint32_t rb = (((top & 0xFF00FF) * a + (bottom & 0xFF00FF) * (256 - a)) >> 8) & 0xFF00FF; // Red and blue in one multiply.
+    uint32_t g = (((top & 0x00FF00) * a + (bottom & 0x00FF00) * (256 - a)) >> 8) & 0x00FF00;
+
+    return (TR_COLOR_TRUE << 24) | rb | g;
+}
 TR_API bool tr_valid_color(uint32_t color) {
     uint32_t mode = tr_color_mode(color);
 
@@ -538,6 +1021,158 @@ TR_API bool tr_valid_color(uint32_t color) {
 // ----------------------------------------------------------------------------
 // ============================================================================
 
+// Writer
+// ============================================================================
+// Helper functions (private)
+// ----------------------------------------------------------------------------
+static void tr_priv_wr_append(TrWriter *w, const char *src, size_t len) {
+    if (w->idx + len > w->len)
+        tr_wr_flush(w);
+
+    if (len > w->len) { // Does not fit even in an empty buffer.
+        fwrite(src, 1, len, stdout);
+        return;
+    }
+
+    memcpy(&w->buf[w->idx], src, len);
+    w->idx += len;
+}
+static void tr_priv_wr_append_str(TrWriter *w, const char *src) {
+    tr_priv_wr_append(w, src, strlen(src));
+}
+static void tr_priv_wr_append_color(TrWriter *w, const char **ansi, uint32_t color, int code_16) {
+    char seq[32];
+    int n = 0;
+    uint32_t mode = tr_color_mode(color);
+
+    switch (mode) {
+    case TR_COLOR_16:
+        n = snprintf(seq, sizeof(seq), ansi[mode], code_16);
+        break;
+    case TR_COLOR_256:
+        n = snprintf(seq, sizeof(seq), ansi[mode], tr_color_code(color));
+        break;
+    case TR_COLOR_TRUE:
+        n = snprintf(seq, sizeof(seq), ansi[mode], tr_rgb_r(color), tr_rgb_g(color), tr_rgb_b(color));
+        break;
+    }
+    if (n > 0)
+        tr_priv_wr_append(w, seq, (size_t)n);
+}
+// ----------------------------------------------------------------------------
+
+TR_API void tr_wr_init(TrWriter *w, char *buf, size_t len) {
+    if (buf == NULL || len == 0) {
+        w->buf = w->internal;
+        w->len = TR_MAX_WRITER_BUFFER_LEN;
+    } else {
+        w->buf = buf;
+        w->len = len;
+    }
+    w->idx = 0;
+    w->effects = TR_DEFAULT_EFFECT;
+    w->fg = TR_DEFAULT_COLOR_16;
+    w->bg = TR_DEFAULT_COLOR_16;
+}
+TR_API void tr_wr_flush(TrWriter *w) {
+    if (w->idx == 0)
+        return;
+
+    tr_priv_term_written(NULL);
+    fwrite(w->buf, 1, w->idx, stdout);
+    fflush(stdout);
+    w->idx = 0;
+}
+TR_API void tr_wr_write(TrWriter *w, const char *text, size_t len) {
+    tr_priv_wr_append(w, text, len);
+}
+TR_API void tr_wr_puts(TrWriter *w, const char *text) {
+    tr_priv_wr_append_str(w, text);
+}
+TR_API void tr_wr_move_cursor(TrWriter *w, int x, int y) {
+    if (x < 0 || y < 0)
+        return;
+
+    char seq[32];
+    int n = snprintf(seq, sizeof(seq), "\x1b[%d;%dH", y + 1, x + 1);
+    if (n > 0)
+        tr_priv_wr_append(w, seq, (size_t)n);
+}
+TR_API void tr_wr_show_cursor(TrWriter *w) {
+    tr_priv_wr_append_str(w, "\x1b[?25h");
+}
+TR_API void tr_wr_hide_cursor(TrWriter *w) {
+    tr_priv_wr_append_str(w, "\x1b[?25l");
+}
+TR_API void tr_wr_add_effects(TrWriter *w, TrEffect effects) {
+    if (effects == TR_DEFAULT_EFFECT) {
+        tr_wr_reset_effects(w);
+        return;
+    }
+    TrEffect added = effects & ~w->effects;
+    for (int i = 0; i < TR_EFFECTS_LEN; i += 1) {
+        if (added & (1 << i))
+            tr_priv_wr_append_str(w, tr_priv_effects_ansi[TR_PRIV_ADD_EFFECTS_IDX + i]);
+    }
+    w->effects |= added;
+}
+TR_API void tr_wr_remove_effects(TrWriter *w, TrEffect effects) {
+    TrEffect removed = effects & w->effects;
+    for (int i = 0; i < TR_EFFECTS_LEN; i += 1) {
+        if (removed & (1 << i))
+            tr_priv_wr_append_str(w, tr_priv_effects_ansi[TR_PRIV_REMOVE_EFFECTS_IDX + i]);
+    }
+    w->effects &= ~removed;
+
+    if (removed & (TR_BOLD | TR_DIM)) { // "\x1b[22m" turned off both of them.
+        TrEffect kept = w->effects & (TR_BOLD | TR_DIM);
+        w->effects &= ~(TR_BOLD | TR_DIM);
+        if (kept != TR_DEFAULT_EFFECT)
+            tr_wr_add_effects(w, kept);
+    }
+}
+TR_API void tr_wr_reset_effects(TrWriter *w) {
+    if (w->effects == TR_DEFAULT_EFFECT)
+        return;
+
+    tr_priv_wr_append_str(w, tr_priv_effects_ansi[TR_PRIV_RESET_EFFECTS_IDX]);
+    w->effects = TR_DEFAULT_EFFECT;
+}
+TR_API void tr_wr_reset_all(TrWriter *w) {
+    if (w->effects == TR_DEFAULT_EFFECT && w->fg == TR_DEFAULT_COLOR_16 && w->bg == TR_DEFAULT_COLOR_16)
+        return;
+
+    tr_priv_wr_append_str(w, tr_priv_effects_ansi[TR_PRIV_RESET_ALL_IDX]);
+    w->effects = TR_DEFAULT_EFFECT;
+    w->fg = TR_DEFAULT_COLOR_16;
+    w->bg = TR_DEFAULT_COLOR_16;
+}
+TR_API TrResult tr_wr_set_fg(TrWriter *w, uint32_t fg) {
+    if (fg == TR_TRANSPARENT || !tr_valid_color(fg))
+        return TR_ERR_BAD_ARG;
+
+    if (w->fg == fg)
+        return TR_OK;
+
+    tr_priv_wr_append_color(w, tr_priv_fg_ansi, fg, (int)tr_color_code(fg));
+    w->fg = fg;
+
+    return TR_OK;
+}
+TR_API TrResult tr_wr_set_bg(TrWriter *w, uint32_t bg) {
+    if (bg == TR_TRANSPARENT || !tr_valid_color(bg))
+        return TR_ERR_BAD_ARG;
+
+    if (w->bg == bg)
+        return TR_OK;
+
+    tr_priv_wr_append_color(w, tr_priv_bg_ansi, bg, 10 + (int)tr_color_code(bg));
+    w->bg = bg;
+
+    return TR_OK;
+}
+// ============================================================================
+
 #ifndef TR_NO_RENDERER
 
 // clang-format off
@@ -583,8 +1218,225 @@ TR_API void tr_copy_style(TrStyle *dst, TrStyle src) {
 }
 // ============================================================================
 
+// Transform
+// ============================================================================
+TR_API TrTransform tr_default_transform(void) {
+    return (TrTransform){
+        .flip_h = false,
+        .flip_v = false,
+        .rotation = 0,
+        .scale = 1,
+    };
+}
+// ============================================================================
+
 // Cell
 // ============================================================================
+// Helper functions (private)
+// ----------------------------------------------------------------------------
+// clang-format off
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+    #include <emmintrin.h>
+    #define TR_PRIV_SSE2
+#endif
+// clang-format on
+static void tr_priv_fill_32(void *dst, uint32_t value, size_t len) { // Fills `len` 32-bit words with wide stores. `dst` doesn't need to be aligned.
+    unsigned char *d = dst;
+    size_t i = 0;
+
+#ifdef TR_PRIV_SSE2
+    __m128i v = _mm_set1_epi32((int)value);
+    for (; i + 8 <= len; i += 8) {
+        _mm_storeu_si128((__m128i *)(d + i * 4), v);
+        _mm_storeu_si128((__m128i *)(d + i * 4 + 16), v);
+    }
+#endif
+    for (; i < len; i += 1) {
+        memcpy(d + i * 4, &value, 4);
+    }
+}
+#define TR_PRIV_GRAPHEME 0xFF // First byte of a letter that holds a grapheme id. UTF8 never uses it.
+
+static bool tr_priv_cell_letter(char *cell, const char *letter) { // Copies a letter given as a string into a cell. Returns false if it is too long. Reads nothing past TR_MAX_UTF8_LEN bytes, since a full cell has no \0.
+    memset(cell, 0, TR_MAX_UTF8_LEN);
+
+    size_t len = TR_MAX_UTF8_LEN; // A grapheme id may contain \0.
+    if ((uint8_t)letter[0] != TR_PRIV_GRAPHEME) {
+        const char *end = memchr(letter, '\0', TR_MAX_UTF8_LEN);
+        if (end == NULL && ((uint8_t)letter[0] & 0xF8) != 0xF0) // Only a 4-byte UTF8 letter fills a cell.
+            return false;
+        if (end != NULL)
+            len = (size_t)(end - letter);
+    }
+
+    memcpy(cell, letter, len);
+    return true;
+}
+static void tr_priv_fill_cell(char (*dst)[TR_MAX_UTF8_LEN], const char *cell, size_t len) {
+    uint32_t word;
+    memcpy(&word, cell, sizeof(word)); // TR_MAX_UTF8_LEN == 4, so a letter is one 32-bit word.
+    tr_priv_fill_32(dst, word, len);
+}
+static void tr_priv_fill_letter(char (*dst)[TR_MAX_UTF8_LEN], const char *letter, size_t len) { // `letter` must fit in a cell.
+    char cell[TR_MAX_UTF8_LEN];
+    tr_priv_cell_letter(cell, letter);
+    tr_priv_fill_cell(dst, cell, len);
+}
+static void tr_priv_fill_effects(TrEffect *dst, TrEffect effects, size_t len) {
+    if (effects == TR_DEFAULT_EFFECT) {
+        memset(dst, TR_DEFAULT_EFFECT, len * sizeof(TrEffect)); // TR_DEFAULT_EFFECT == 0, ok to memset.
+    } else if (sizeof(TrEffect) == sizeof(uint32_t)) {
+        tr_priv_fill_32(dst, (uint32_t)effects, len);
+    } else {
+        for (size_t i = 0; i < len; i += 1) {
+            dst[i] = effects;
+        }
+    }
+}
+#ifdef TR_PRIV_SSE2
+static __m128i tr_priv_select_128(__m128i mask, __m128i a, __m128i b) { // Lanes of `a` where `mask` is set, of `b` elsewhere.
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+static __m128i tr_priv_blend_128(__m128i top, __m128i bottom, __m128i a, __m128i inv_a) { // Mixes the channels of 4 true colors like `tr_blend`. `a` and `inv_a` are 16-bit lanes of a and 256 - a.
+    __m128i zero = _mm_setzero_si128();
+
+    // A channel times a is at most 255 * 256, so the sum of both fits in a 16-bit lane.
+    __m128i lo = _mm_add_epi16(_mm_mullo_epi16(_mm_unpacklo_epi8(top, zero), a), _mm_mullo_epi16(_mm_unpacklo_epi8(bottom, zero), inv_a));
+    __m128i hi = _mm_add_epi16(_mm_mullo_epi16(_mm_unpackhi_epi8(top, zero), a), _mm_mullo_epi16(_mm_unpackhi_epi8(bottom, zero), inv_a));
+    __m128i mixed = _mm_packus_epi16(_mm_srli_epi16(lo, 8), _mm_srli_epi16(hi, 8));
+
+    return _mm_or_si128(_mm_and_si128(mixed, _mm_set1_epi32(0xFFFFFF)), _mm_set1_epi32(TR_COLOR_TRUE << 24));
+}
+#endif
+static void tr_priv_blend_row(uint32_t *dst, const uint32_t *bottom, const uint32_t *top, size_t len, uint8_t alpha) { // `tr_blend` over a row. TR_TRANSPARENT in `top` keeps `dst`.
+    uint32_t a = (uint32_t)alpha + (alpha >> 7);
+    size_t i = 0;
+
+#ifdef TR_PRIV_SSE2
+    __m128i va = _mm_set1_epi16((short)a);
+    __m128i inv_a = _mm_set1_epi16((short)(256 - a));
+    __m128i true_mode = _mm_set1_epi32(TR_COLOR_TRUE);
+    __m128i transparent = _mm_set1_epi32(TR_TRANSPARENT);
+    for (; i + 4 <= len; i += 4) {
+        __m128i t = _mm_loadu_si128((const __m128i *)&top[i]);
+        __m128i b = _mm_loadu_si128((const __m128i *)&bottom[i]);
+        __m128i d = _mm_loadu_si128((const __m128i *)&dst[i]);
+        __m128i both_true = _mm_and_si128(_mm_cmpeq_epi32(_mm_srli_epi32(t, 24), true_mode), _mm_cmpeq_epi32(_mm_srli_epi32(b, 24), true_mode));
+        __m128i out = tr_priv_select_128(both_true, tr_priv_blend_128(t, b, va, inv_a), alpha >= 128 ? t : b);
+
+        _mm_storeu_si128((__m128i *)&dst[i], tr_priv_select_128(_mm_cmpeq_epi32(t, transparent), d, out));
+    }
+#endif
+    for (; i < len; i += 1) {
+        uint32_t t = top[i];
+        uint32_t b = bottom[i];
+        uint32_t rb = (((t & 0xFF00FF) * a + (b & 0xFF00FF) * (256 - a)) >> 8) & 0xFF00FF;
+        uint32_t g = (((t & 0x00FF00) * a + (b & 0x00FF00) * (256 - a)) >> 8) & 0x00FF00;
+        bool both_true = ((t >> 24) == TR_COLOR_TRUE) & ((b >> 24) == TR_COLOR_TRUE);
+        uint32_t fallback = alpha >= 128 ? t : b;
+        uint32_t out = both_true ? ((TR_COLOR_TRUE << 24) | rb | g) : fallback;
+
+        dst[i] = t == TR_TRANSPARENT ? dst[i] : out;
+    }
+}
+static void tr_priv_blend_row_color(uint32_t *dst, const uint32_t *bottom, uint32_t top, size_t len, uint8_t alpha) { // `tr_blend` of one color over a row.
+    if (tr_color_mode(top) != TR_COLOR_TRUE) {
+        for (size_t i = 0; i < len; i += 1) {
+            dst[i] = tr_blend(bottom[i], top, alpha);
+        }
+        return;
+    }
+
+    uint32_t a = (uint32_t)alpha + (alpha >> 7);
+    uint32_t top_rb = (top & 0xFF00FF) * a;
+    uint32_t top_g = (top & 0x00FF00) * a;
+    size_t i = 0;
+
+#ifdef TR_PRIV_SSE2
+    __m128i va = _mm_set1_epi16((short)a);
+    __m128i inv_a = _mm_set1_epi16((short)(256 - a));
+    __m128i t = _mm_set1_epi32((int)top);
+    __m128i true_mode = _mm_set1_epi32(TR_COLOR_TRUE);
+    for (; i + 4 <= len; i += 4) {
+        __m128i b = _mm_loadu_si128((const __m128i *)&bottom[i]);
+        __m128i is_true = _mm_cmpeq_epi32(_mm_srli_epi32(b, 24), true_mode);
+
+        _mm_storeu_si128((__m128i *)&dst[i], tr_priv_select_128(is_true, tr_priv_blend_128(t, b, va, inv_a), alpha >= 128 ? t : b));
+    }
+#endif
+    for (; i < len; i += 1) {
+        uint32_t b = bottom[i];
+        uint32_t rb = ((top_rb + (b & 0xFF00FF) * (256 - a)) >> 8) & 0xFF00FF;
+        uint32_t g = ((top_g + (b & 0x00FF00) * (256 - a)) >> 8) & 0x00FF00;
+        uint32_t fallback = alpha >= 128 ? top : b;
+
+        dst[i] = (b >> 24) == TR_COLOR_TRUE ? ((TR_COLOR_TRUE << 24) | rb | g) : fallback;
+    }
+}
+static void tr_priv_box_sum(uint32_t sum[4], const uint8_t *pixels, int img_w, int channels, int x0, int x1, int y0, int y1) { // Sums each channel over [x0, x1) x [y0, y1).
+    sum[0] = sum[1] = sum[2] = sum[3] = 0;
+    int vec_w = 0; // Pixels at the start of each row that are summed 4 at a time.
+
+#ifdef TR_PRIV_SSE2
+    // Lanes are folded into `sum` once per box, so narrow boxes skip this.
+    __m128i zero = _mm_setzero_si128();
+    __m128i acc[3] = {zero, zero, zero};
+
+    if (channels == 4) { // 4 RGBA pixels per load, widened to 32-bit lanes of R, G, B, A.
+        vec_w = (x1 - x0) / 4 * 4;
+        for (int y = y0; y < y1 && vec_w > 0; y += 1) {
+            const uint8_t *p = pixels + ((size_t)y * (size_t)img_w + (size_t)x0) * 4;
+            for (int i = 0; i < vec_w; i += 4, p += 16) {
+                __m128i px = _mm_loadu_si128((const __m128i *)p);
+                __m128i pairs = _mm_add_epi16(_mm_unpacklo_epi8(px, zero), _mm_unpackhi_epi8(px, zero)); // pixel 0 + 2, pixel 1 + 3
+                acc[0] = _mm_add_epi32(acc[0], _mm_unpacklo_epi16(pairs, zero));
+                acc[0] = _mm_add_epi32(acc[0], _mm_unpackhi_epi16(pairs, zero));
+            }
+        }
+        if (vec_w > 0) {
+            uint32_t lanes[4];
+            _mm_storeu_si128((__m128i *)lanes, acc[0]);
+            for (int c = 0; c < 4; c += 1) {
+                sum[c] += lanes[c];
+            }
+        }
+    } else { // 4 RGB pixels per load. Lane i holds channel i % 3. The last 4 bytes of a load are the next pixels, so 2 more pixels must be in the box.
+        vec_w = x1 - x0 >= 6 ? (x1 - x0 - 2) / 4 * 4 : 0;
+        for (int y = y0; y < y1 && vec_w > 0; y += 1) {
+            const uint8_t *p = pixels + ((size_t)y * (size_t)img_w + (size_t)x0) * 3;
+            for (int i = 0; i < vec_w; i += 4, p += 12) {
+                __m128i px = _mm_loadu_si128((const __m128i *)p);
+                __m128i lo = _mm_unpacklo_epi8(px, zero);
+                acc[0] = _mm_add_epi32(acc[0], _mm_unpacklo_epi16(lo, zero));
+                acc[1] = _mm_add_epi32(acc[1], _mm_unpackhi_epi16(lo, zero));
+                acc[2] = _mm_add_epi32(acc[2], _mm_unpacklo_epi16(_mm_unpackhi_epi8(px, zero), zero));
+            }
+        }
+        if (vec_w > 0) {
+            uint32_t lanes[12];
+            for (int i = 0; i < 3; i += 1) {
+                _mm_storeu_si128((__m128i *)&lanes[i * 4], acc[i]);
+            }
+            for (int i = 0; i < 12; i += 1) {
+                sum[i % 3] += lanes[i];
+            }
+            sum[3] += (uint32_t)(vec_w * (y1 - y0)) * 255;
+        }
+    }
+#endif
+    for (int y = y0; y < y1; y += 1) {
+        const uint8_t *p = pixels + ((size_t)y * (size_t)img_w + (size_t)(x0 + vec_w)) * (size_t)channels;
+
+        for (int x = x0 + vec_w; x < x1; x += 1, p += channels) {
+            sum[0] += p[0];
+            sum[1] += p[1];
+            sum[2] += p[2];
+            sum[3] += channels == 4 ? p[3] : 255;
+        }
+    }
+}
+// ----------------------------------------------------------------------------
+
 TR_API TrResult tr_carr_init(TrCellArray *carr, int width, int height) {
     if (width <= 0 || height <= 0 || (width * height > TR_MAX_CELL_ARRAY_LEN)) {
         carr->width = 0;
@@ -664,8 +1516,7 @@ TR_API void tr_cvec_cleanup(TrCellVector *cvec) {
         (*idx) += _s;                                                        \
     } while (0)
 
-static TrResult tr_priv_strcat(char *dst, size_t dst_len, size_t *idx, const char *src) {
-    size_t src_len = strlen(src);
+static TrResult tr_priv_strcat_n(char *dst, size_t dst_len, size_t *idx, const char *src, size_t src_len) {
     if (*idx + src_len >= dst_len - 1)
         return TR_ERR_BUF_OVERFLOW;
 
@@ -674,26 +1525,235 @@ static TrResult tr_priv_strcat(char *dst, size_t dst_len, size_t *idx, const cha
 
     return TR_OK;
 }
-static TrResult tr_priv_emit_ansi(char *dst, size_t len, size_t *idx, TrStyle *curr, TrCellSpan sprite, int spr_idx) {
-    if (curr->effects != sprite.effects[spr_idx]) {
-        TR_CHK(tr_strcat_add_effects(dst, len, idx, sprite.effects[spr_idx] & ~curr->effects));
-        TR_CHK(tr_strcat_remove_effects(dst, len, idx, curr->effects & ~sprite.effects[spr_idx]));
-        curr->effects = sprite.effects[spr_idx];
-    }
+static TrResult tr_priv_strcat(char *dst, size_t dst_len, size_t *idx, const char *src) {
+    return tr_priv_strcat_n(dst, dst_len, idx, src, strlen(src));
+}
+static TrResult tr_priv_emit_effects(char *dst, size_t len, size_t *idx, const TrEncoder *enc, TrStyle *curr, TrEffect effects) {
+    if (curr->effects == effects)
+        return TR_OK;
+
+    TrEffect removed = curr->effects & ~effects;
+    TrEffect added = effects & ~curr->effects;
+    if (removed & (TR_BOLD | TR_DIM)) // "\x1b[22m" turns off both of them.
+        added |= effects & (TR_BOLD | TR_DIM);
+
+    TR_CHK(enc->set_effects(dst, len, idx, removed, added));
+    curr->effects = effects;
+
+    return TR_OK;
+}
+static TrResult tr_priv_emit_ansi(char *dst, size_t len, size_t *idx, const TrEncoder *enc, TrStyle *curr, TrCellSpan sprite, int spr_idx) {
+    TR_CHK(tr_priv_emit_effects(dst, len, idx, enc, curr, sprite.effects[spr_idx]));
 
     if (curr->fg != sprite.fg[spr_idx]) {
-        TR_CHK(tr_strcat_set_fg(dst, len, idx, sprite.fg[spr_idx]));
+        TR_CHK(enc->set_fg(dst, len, idx, sprite.fg[spr_idx]));
         curr->fg = sprite.fg[spr_idx];
     }
 
     if (curr->bg != sprite.bg[spr_idx]) {
-        TR_CHK(tr_strcat_set_bg(dst, len, idx, sprite.bg[spr_idx]));
+        TR_CHK(enc->set_bg(dst, len, idx, sprite.bg[spr_idx]));
         curr->bg = sprite.bg[spr_idx];
     }
 
     return TR_OK;
 }
-// ----------------------------------------------------------------------------
+static TrResult tr_priv_emit_ansi_cached(char *dst, size_t len, size_t *idx, const TrEncoder *enc, TrStyle *curr, const TrStyleTable *styles, uint16_t id) { // Same as `tr_priv_emit_ansi`, but copies the color codes formatted by the style table.
+    const TrStyle *next = &styles->styles[id];
+
+    TR_CHK(tr_priv_emit_effects(dst, len, idx, enc, curr, next->effects));
+
+    if (curr->fg != next->fg) {
+        if (styles->fg_len[id] == 0) // Let it report the error.
+            TR_CHK(enc->set_fg(dst, len, idx, next->fg));
+        TR_CHK(tr_priv_strcat_n(dst, len, idx, styles->fg_ansi[id], styles->fg_len[id]));
+        curr->fg = next->fg;
+    }
+
+    if (curr->bg != next->bg) {
+        if (styles->bg_len[id] == 0)
+            TR_CHK(enc->set_bg(dst, len, idx, next->bg));
+        TR_CHK(tr_priv_strcat_n(dst, len, idx, styles->bg_ansi[id], styles->bg_len[id]));
+        curr->bg = next->bg;
+    }
+
+    return TR_OK;
+}
+static int tr_priv_digits(int n) {
+    int digits = 1;
+    while (n >= 10) {
+        n /= 10;
+        digits += 1;
+    }
+    return digits;
+}
+static const char *tr_priv_letter(const TrGraphemePool *pool, const char *letter, size_t *len) { // Bytes of a letter. Grapheme ids are looked up in `pool`, or drawn as U+FFFD without it.
+    if ((uint8_t)letter[0] == TR_PRIV_GRAPHEME) {
+        int id = (uint8_t)letter[1] | (uint8_t)letter[2] << 8;
+        if (pool != NULL && id < pool->count) {
+            *len = pool->len[id];
+            return &pool->bytes[pool->offset[id]];
+        }
+        *len = 3;
+        return "\xef\xbf\xbd";
+    }
+
+    const char *end = memchr(letter, '\0', TR_MAX_UTF8_LEN);
+    *len = end != NULL ? (size_t)(end - letter) : TR_MAX_UTF8_LEN;
+    return letter;
+}
+static int tr_priv_run_len(TrCellSpan ss, const uint16_t *ids, int spr_idx, int max) { // Counts identical cells from `spr_idx`, up to `max`.
+    int run = 1;
+
+    for (; run < max; run += 1) {
+        int i = spr_idx + run;
+
+        if (memcmp(ss.letter[i], ss.letter[spr_idx], TR_MAX_UTF8_LEN) != 0)
+            break;
+        if (ids != NULL) {
+            if (ids[i] != ids[spr_idx])
+                break;
+        } else if (ss.effects[i] != ss.effects[spr_idx] || ss.fg[i] != ss.fg[spr_idx] || ss.bg[i] != ss.bg[spr_idx]) {
+            break;
+        }
+    }
+
+    return run;
+}
+static TrResult tr_priv_strcat_run(char *dst, size_t len, size_t *idx, uint32_t caps, const char *letter, bool blank, int run, bool row_end, int *advance) { // Appends `run` copies of a letter in the current style. Uses REP or ECH if it is shorter. `advance` is how far the cursor moved.
+    *advance = run;
+
+    size_t letter_len = strlen(letter);
+    size_t plain = letter_len * (size_t)run;
+    size_t rep = SIZE_MAX;
+    size_t ech = SIZE_MAX;
+
+    if ((caps & TR_CAP_REP) && run > 1 && letter_len > 0)
+        rep = letter_len + 3 + (size_t)tr_priv_digits(run - 1);
+    if ((caps & TR_CAP_ECH) && blank) // ECH does not move the cursor. Skip the erased cells unless the row ends.
+        ech = (size_t)(3 + tr_priv_digits(run)) * (row_end ? 1 : 2);
+
+    if (ech < plain && ech <= rep) {
+        TR_PRIV_STRCAT_FMT(dst, len, idx, "\x1b[%dX", run);
+        if (!row_end)
+            TR_PRIV_STRCAT_FMT(dst, len, idx, "\x1b[%dC", run);
+        else
+            *advance = 0;
+        return TR_OK;
+    }
+    if (rep < plain) {
+        TR_CHK(tr_priv_strcat_n(dst, len, idx, letter, letter_len));
+        TR_PRIV_STRCAT_FMT(dst, len, idx, "\x1b[%db", run - 1);
+        return TR_OK;
+    }
+    for (int i = 0; i < run; i += 1) {
+        TR_CHK(tr_priv_strcat_n(dst, len, idx, letter, letter_len));
+    }
+
+    return TR_OK;
+}
+static TrResult tr_priv_strcat_spritesheet(char *dst, size_t len, size_t *idx, const TrEncoder *enc, TrTerminalState *term, TrCellSpan ss, const TrStyleTable *styles, const uint16_t *ids, const TrGraphemePool *pool, int spr_x, int spr_y, int spr_w, int spr_h, int x, int y) { // Appends a validated sprite of a spritesheet to dst. `ids` are style ids of `ss` in `styles`, or NULL. Grapheme ids are looked up in `pool`.
+    // Without `term`, it starts from the default style and leaves the terminal reset.
+    // With `term`, it starts from the state left by the previous string and updates it.
+    TrStyle curr = tr_default_style();
+    int cursor_x = -1, cursor_y = -1;
+    if (term != NULL) {
+        if (!term->known)
+            TR_CHK(tr_strcat_reset_all(dst, len, idx));
+        else
+            curr = term->style;
+        cursor_x = term->known ? term->cursor_x : -1;
+        cursor_y = term->known ? term->cursor_y : -1;
+    }
+    int curr_id = -1; // Style id of `curr`. -1 if unknown.
+
+    for (int row = 0; row < spr_h; row += 1) {
+        if (cursor_y == y + row && cursor_x >= 0 && cursor_x < x) // Forward on the same row is shorter.
+            TR_PRIV_STRCAT_FMT(dst, len, idx, "\x1b[%dC", x - cursor_x);
+        else if (cursor_x != x || cursor_y != y + row)
+            TR_CHK(tr_strcat_move_cursor(dst, len, idx, x, y + row));
+        cursor_x = x;
+        cursor_y = y + row;
+
+        int spr_row_base = spr_x + (spr_y + row) * ss.width; // [spr_row_base] == [spr_y + row][spr_x]
+
+        for (int col = 0; col < spr_w;) {
+            int spr_idx = col + spr_row_base; // [spr_idx] == [spr_y + row][spr_x + col]
+            const char *letter = ss.letter[spr_idx];
+
+            if (letter[0] == '\0') { // Covered by a wide grapheme on the left.
+                col += 1;
+                cursor_x = -1;
+                continue;
+            }
+            if (cursor_x != x + col) {
+                TR_CHK(tr_strcat_move_cursor(dst, len, idx, x + col, y + row));
+                cursor_x = x + col;
+            }
+
+            if (ids == NULL) {
+                TR_CHK(tr_priv_emit_ansi(dst, len, idx, enc, &curr, ss, spr_idx));
+            } else if (ids[spr_idx] != curr_id) {
+                TR_CHK(tr_priv_emit_ansi_cached(dst, len, idx, enc, &curr, styles, ids[spr_idx]));
+                curr_id = ids[spr_idx];
+            }
+
+            if ((uint8_t)letter[0] == TR_PRIV_GRAPHEME || letter[TR_MAX_UTF8_LEN - 1] != '\0') { // Terminals disagree on the width of emojis and clusters, so the next cell moves the cursor.
+                size_t n = 0;
+                const char *bytes = tr_priv_letter(pool, letter, &n);
+                TR_CHK(tr_priv_strcat_n(dst, len, idx, bytes, n));
+                col += 1;
+                cursor_x = -1;
+                continue;
+            }
+            if (enc->caps == 0) {
+                TR_CHK(tr_priv_strcat(dst, len, idx, letter));
+                col += 1;
+                cursor_x += 1;
+                continue;
+            }
+
+            int run = tr_priv_run_len(ss, ids, spr_idx, spr_w - col);
+            int advance = 0;
+            bool blank = strcmp(letter, " ") == 0 && ss.effects[spr_idx] == TR_DEFAULT_EFFECT;
+            TR_CHK(tr_priv_strcat_run(dst, len, idx, enc->caps, letter, blank, run, col + run == spr_w, &advance));
+            col += run;
+            cursor_x += advance;
+        }
+
+        if (term == NULL && curr.bg != TR_DEFAULT_COLOR_16) {
+            curr.bg = TR_DEFAULT_COLOR_16;
+            curr_id = -1;
+            TR_CHK(enc->set_bg(dst, len, idx, curr.bg));
+        }
+    }
+
+    if (term == NULL) {
+        TR_CHK(tr_strcat_reset_all(dst, len, idx));
+    } else {
+        term->style = curr;
+        term->cursor_x = cursor_x;
+        term->cursor_y = cursor_y;
+        term->known = true;
+    }
+
+    return TR_OK;
+}
+static TrResult tr_priv_strcat_scroll(char *dst, size_t len, size_t *idx, const TrEncoder *enc, TrTerminalState *term, int y, int height, int n) { // Appends a string that scrolls terminal rows [y, y + height) up by `n` with the default background.
+    if (!term->known) {
+        TR_CHK(tr_strcat_reset_all(dst, len, idx));
+        term->style = tr_default_style();
+        term->known = true;
+    } else if (term->style.bg != TR_DEFAULT_COLOR_16) { // New rows are filled with the current bg.
+        TR_CHK(enc->set_bg(dst, len, idx, TR_DEFAULT_COLOR_16));
+        term->style.bg = TR_DEFAULT_COLOR_16;
+    }
+    TR_PRIV_STRCAT_FMT(dst, len, idx, "\x1b[%d;%dr\x1b[%dS\x1b[r", y + 1, y + height, n);
+    term->cursor_x = 0; // Setting margins moves the cursor home.
+    term->cursor_y = 0;
+
+    return TR_OK;
+}
+// ----------------------------------------------------------------------------
 
 // Cursor
 // ----------------------------------------------------------------------------
@@ -786,6 +1846,272 @@ TR_API TrResult tr_strcat_set_bg(char *dst, size_t len, size_t *idx, uint32_t bg
 }
 // ----------------------------------------------------------------------------
 
+// Encoder
+// ----------------------------------------------------------------------------
+static const uint8_t tr_priv_palette_16[16][3] = { // xterm defaults of 30..37 and 90..97.
+    {0, 0, 0}, {205, 0, 0}, {0, 205, 0}, {205, 205, 0}, {0, 0, 238}, {205, 0, 205}, {0, 205, 205}, {229, 229, 229},
+    {127, 127, 127}, {255, 0, 0}, {0, 255, 0}, {255, 255, 0}, {92, 92, 255}, {255, 0, 255}, {0, 255, 255}, {255, 255, 255},
+};
+static const uint8_t tr_priv_cube_levels[6] = {0, 95, 135, 175, 215, 255};
+static const uint8_t tr_priv_effect_codes[2][TR_EFFECTS_LEN] = {
+    {1, 2, 3, 4, 5, 7, 8, 9},         // Add
+    {22, 22, 23, 24, 25, 27, 28, 29}, // Remove
+};
+
+static size_t tr_priv_u8toa(char *dst, uint32_t v) { // Writes 0..255 without snprintf. Returns the number of digits.
+    if (v >= 100) {
+        dst[0] = (char)('0' + v / 100);
+        dst[1] = (char)('0' + v / 10 % 10);
+        dst[2] = (char)('0' + v % 10);
+        return 3;
+    }
+    if (v >= 10) {
+        dst[0] = (char)('0' + v / 10);
+        dst[1] = (char)('0' + v % 10);
+        return 2;
+    }
+    dst[0] = (char)('0' + v);
+    return 1;
+}
+static int tr_priv_index_16(uint32_t color) { // 30..37 -> 0..7, 90..97 -> 8..15
+    uint32_t code = color & 0xFF;
+    return (int)((code >= 90 ? code - 90 + 8 : code - 30) & 15);
+}
+static uint32_t tr_priv_to_rgb(uint32_t color) { // Any color -> 0xRRGGBB
+    uint32_t code = color & 0xFF;
+    const uint8_t *c;
+
+    switch (tr_color_mode(color)) {
+    case TR_COLOR_16:
+        c = tr_priv_palette_16[tr_priv_index_16(color)];
+        return ((uint32_t)c[0] << 16) | ((uint32_t)c[1] << 8) | c[2];
+    case TR_COLOR_256:
+        if (code < 16) {
+            c = tr_priv_palette_16[code];
+            return ((uint32_t)c[0] << 16) | ((uint32_t)c[1] << 8) | c[2];
+        }
+        if (code < 232) {
+            code -= 16;
+            return ((uint32_t)tr_priv_cube_levels[code / 36] << 16) | ((uint32_t)tr_priv_cube_levels[code / 6 % 6] << 8) | tr_priv_cube_levels[code % 6];
+        }
+        code = 8 + (code - 232) * 10;
+        return (code << 16) | (code << 8) | code;
+    default:
+        return color & 0xFFFFFF;
+    }
+}
+static int tr_priv_cube_index(int v) { // Nearest level of the 6x6x6 cube.
+    return v < 48 ? 0 : v < 115 ? 1 : (v - 35) / 40;
+}
+static uint32_t tr_priv_rgb_to_256(uint32_t rgb) {
+    int r = (rgb >> 16) & 0xFF, g = (rgb >> 8) & 0xFF, b = rgb & 0xFF;
+    int ri = tr_priv_cube_index(r), gi = tr_priv_cube_index(g), bi = tr_priv_cube_index(b);
+    int cr = tr_priv_cube_levels[ri], cg = tr_priv_cube_levels[gi], cb = tr_priv_cube_levels[bi];
+
+    int avg = (r + g + b) / 3; // The gray ramp is closer for unsaturated colors.
+    int gray_i = avg > 238 ? 23 : (avg - 3) / 10;
+    if (gray_i < 0)
+        gray_i = 0;
+    int gv = 8 + gray_i * 10;
+
+    int cube_dist = (r - cr) * (r - cr) + (g - cg) * (g - cg) + (b - cb) * (b - cb);
+    int gray_dist = (r - gv) * (r - gv) + (g - gv) * (g - gv) + (b - gv) * (b - gv);
+
+    return gray_dist < cube_dist ? (uint32_t)(232 + gray_i) : (uint32_t)(16 + ri * 36 + gi * 6 + bi);
+}
+static int tr_priv_rgb_to_16(uint32_t rgb) {
+    int r = (rgb >> 16) & 0xFF, g = (rgb >> 8) & 0xFF, b = rgb & 0xFF;
+    int best = 0, best_dist = 0x7FFFFFFF;
+
+    for (int i = 0; i < 16; i += 1) {
+        int dr = r - tr_priv_palette_16[i][0], dg = g - tr_priv_palette_16[i][1], db = b - tr_priv_palette_16[i][2];
+        int dist = dr * dr + dg * dg + db * db;
+        if (dist < best_dist) {
+            best = i;
+            best_dist = dist;
+        }
+    }
+
+    return best;
+}
+
+// Every sequence below fits in 20 bytes.
+#define TR_PRIV_ENC_RESERVE(len, idx)   \
+    do {                                \
+        if ((*idx) + 20 >= (len) - 1)   \
+            return TR_ERR_BUF_OVERFLOW; \
+    } while (0)
+
+static TrResult tr_priv_enc_default(char *dst, size_t *idx, char layer) { // "\x1b[39m" or "\x1b[49m"
+    memcpy(&dst[*idx], "\x1b[39m", 5);
+    dst[*idx + 2] = layer;
+    *idx += 5;
+
+    return TR_OK;
+}
+static TrResult tr_priv_enc_true(char *dst, size_t len, size_t *idx, uint32_t color, char layer) {
+    TR_PRIV_ENC_RESERVE(len, idx);
+    if (color == TR_DEFAULT_COLOR_16)
+        return tr_priv_enc_default(dst, idx, layer);
+
+    uint32_t rgb = tr_color_mode(color) == TR_COLOR_TRUE ? color : tr_priv_to_rgb(color);
+    char *p = &dst[*idx];
+
+    memcpy(p, "\x1b[38;2;", 7);
+    p[2] = layer;
+    p += 7;
+    p += tr_priv_u8toa(p, (rgb >> 16) & 0xFF);
+    *p++ = ';';
+    p += tr_priv_u8toa(p, (rgb >> 8) & 0xFF);
+    *p++ = ';';
+    p += tr_priv_u8toa(p, rgb & 0xFF);
+    *p++ = 'm';
+    *idx = (size_t)(p - dst);
+
+    return TR_OK;
+}
+static TrResult tr_priv_enc_256(char *dst, size_t len, size_t *idx, uint32_t color, char layer) {
+    TR_PRIV_ENC_RESERVE(len, idx);
+    if (color == TR_DEFAULT_COLOR_16)
+        return tr_priv_enc_default(dst, idx, layer);
+
+    uint32_t mode = tr_color_mode(color);
+    uint32_t code = mode == TR_COLOR_256 ? (color & 0xFF) : mode == TR_COLOR_16 ? (uint32_t)tr_priv_index_16(color) : tr_priv_rgb_to_256(color);
+    char *p = &dst[*idx];
+
+    memcpy(p, "\x1b[38;5;", 7);
+    p[2] = layer;
+    p += 7;
+    p += tr_priv_u8toa(p, code);
+    *p++ = 'm';
+    *idx = (size_t)(p - dst);
+
+    return TR_OK;
+}
+static TrResult tr_priv_enc_16(char *dst, size_t len, size_t *idx, uint32_t color, uint32_t base) { // `base` is 0 for fg, 10 for bg.
+    TR_PRIV_ENC_RESERVE(len, idx);
+
+    uint32_t code;
+    if (color == TR_DEFAULT_COLOR_16) {
+        code = 39;
+    } else {
+        int i = tr_color_mode(color) == TR_COLOR_16 ? tr_priv_index_16(color) : tr_priv_rgb_to_16(tr_priv_to_rgb(color));
+        code = i < 8 ? 30 + (uint32_t)i : 90 + (uint32_t)i - 8;
+    }
+    char *p = &dst[*idx];
+
+    *p++ = '\x1b';
+    *p++ = '[';
+    p += tr_priv_u8toa(p, code + base);
+    *p++ = 'm';
+    *idx = (size_t)(p - dst);
+
+    return TR_OK;
+}
+static TrResult tr_priv_enc_true_fg(char *dst, size_t len, size_t *idx, uint32_t color) {
+    return tr_priv_enc_true(dst, len, idx, color, '3');
+}
+static TrResult tr_priv_enc_true_bg(char *dst, size_t len, size_t *idx, uint32_t color) {
+    return tr_priv_enc_true(dst, len, idx, color, '4');
+}
+static TrResult tr_priv_enc_256_fg(char *dst, size_t len, size_t *idx, uint32_t color) {
+    return tr_priv_enc_256(dst, len, idx, color, '3');
+}
+static TrResult tr_priv_enc_256_bg(char *dst, size_t len, size_t *idx, uint32_t color) {
+    return tr_priv_enc_256(dst, len, idx, color, '4');
+}
+static TrResult tr_priv_enc_16_fg(char *dst, size_t len, size_t *idx, uint32_t color) {
+    return tr_priv_enc_16(dst, len, idx, color, 0);
+}
+static TrResult tr_priv_enc_16_bg(char *dst, size_t len, size_t *idx, uint32_t color) {
+    return tr_priv_enc_16(dst, len, idx, color, 10);
+}
+static TrResult tr_priv_enc_effects(char *dst, size_t len, size_t *idx, TrEffect removed, TrEffect added) { // Writes all changes in one sequence.
+    if ((*idx) + 2 + TR_EFFECTS_LEN * 2 * 3 >= len - 1)
+        return TR_ERR_BUF_OVERFLOW;
+
+    unsigned int all = (1u << TR_EFFECTS_LEN) - 1;
+    unsigned int masks[2] = {(unsigned int)removed & all, (unsigned int)added & all};
+    if (masks[0] == 0 && masks[1] == 0)
+        return TR_OK;
+
+    char *p = &dst[*idx];
+
+    *p++ = '\x1b';
+    *p++ = '[';
+    if (masks[0] & (TR_BOLD | TR_DIM)) { // One "22" turns off both of them.
+        memcpy(p, "22;", 3);
+        p += 3;
+        masks[0] &= ~(unsigned int)(TR_BOLD | TR_DIM);
+    }
+    for (int op = 0; op < 2; op += 1) { // Removals first.
+        const uint8_t *codes = tr_priv_effect_codes[1 - op];
+        unsigned int mask = masks[op];
+
+        for (int i = 0; mask != 0; i += 1, mask >>= 1) {
+            if (mask & 1) {
+                p += tr_priv_u8toa(p, codes[i]);
+                *p++ = ';';
+            }
+        }
+    }
+    p[-1] = 'm'; // Replaces the last ';'.
+    *idx = (size_t)(p - dst);
+
+    return TR_OK;
+}
+static TrResult tr_priv_enc_effects_generic(char *dst, size_t len, size_t *idx, TrEffect removed, TrEffect added) {
+    if (removed != TR_DEFAULT_EFFECT)
+        TR_CHK(tr_strcat_remove_effects(dst, len, idx, removed));
+    if (added != TR_DEFAULT_EFFECT)
+        TR_CHK(tr_strcat_add_effects(dst, len, idx, added));
+
+    return TR_OK;
+}
+static TrResult tr_priv_enc_effects_none(char *dst, size_t len, size_t *idx, TrEffect removed, TrEffect added) {
+    (void)dst;
+    (void)len;
+    (void)idx;
+    (void)removed;
+    (void)added;
+
+    return TR_OK;
+}
+static const TrEncoder tr_priv_generic_encoder = {
+    .set_fg = tr_strcat_set_fg,
+    .set_bg = tr_strcat_set_bg,
+    .set_effects = tr_priv_enc_effects_generic,
+};
+
+TR_API TrEncoder tr_encoder(TrEncoderColors colors, bool effects) {
+    TrEncoder enc = tr_priv_generic_encoder;
+
+    switch (colors) {
+    case TR_ENCODER_TRUE_COLOR:
+        enc.set_fg = tr_priv_enc_true_fg;
+        enc.set_bg = tr_priv_enc_true_bg;
+        enc.set_effects = tr_priv_enc_effects;
+        break;
+    case TR_ENCODER_256:
+        enc.set_fg = tr_priv_enc_256_fg;
+        enc.set_bg = tr_priv_enc_256_bg;
+        enc.set_effects = tr_priv_enc_effects;
+        break;
+    case TR_ENCODER_16:
+        enc.set_fg = tr_priv_enc_16_fg;
+        enc.set_bg = tr_priv_enc_16_bg;
+        enc.set_effects = tr_priv_enc_effects;
+        break;
+    case TR_ENCODER_GENERIC:
+        break;
+    }
+    if (!effects)
+        enc.set_effects = tr_priv_enc_effects_none;
+
+    return enc;
+}
+// ----------------------------------------------------------------------------
+
 // Rendering functions
 // ----------------------------------------------------------------------------
 TR_API TrResult tr_draw_sprite(TrCellSpan sprite, int x, int y) {
@@ -806,8 +2132,11 @@ TR_API TrResult tr_draw_sprite(TrCellSpan sprite, int x, int y) {
         for (int col = 0; col < sprite.width; col += 1) {
             int spr_idx = col + row * sprite.width; // [spr_idx] == [row][col]
 
-            TR_CHK(tr_priv_emit_ansi(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx, &curr, sprite, spr_idx));
-            TR_CHK(tr_priv_strcat(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx, sprite.letter[spr_idx]));
+            size_t letter_len = 0;
+            const char *letter = tr_priv_letter(NULL, sprite.letter[spr_idx], &letter_len);
+
+            TR_CHK(tr_priv_emit_ansi(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx, &tr_priv_generic_encoder, &curr, sprite, spr_idx));
+            TR_CHK(tr_priv_strcat_n(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx, letter, letter_len));
         }
 
         if (curr.bg != TR_DEFAULT_COLOR_16) {
@@ -818,6 +2147,7 @@ TR_API TrResult tr_draw_sprite(TrCellSpan sprite, int x, int y) {
     TR_CHK(tr_strcat_reset_all(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx));
 
     raw_buf[raw_buf_idx] = '\0';
+    tr_priv_term_written(NULL);
     fputs(raw_buf, stdout);
 
     return TR_OK;
@@ -835,34 +2165,13 @@ TR_API TrResult tr_draw_spritesheet(TrCellSpan ss, int spr_x, int spr_y, int spr
         (spr_y + spr_h > ss.height))
         return TR_ERR_BAD_ARG;
 
-    TrStyle curr = {
-        .effects = TR_DEFAULT_EFFECT,
-        .fg = TR_DEFAULT_COLOR_16,
-        .bg = TR_DEFAULT_COLOR_16,
-    };
     size_t raw_buf_idx = 0;
     char raw_buf[TR_MAX_RAW_BUFFER_LEN];
 
-    for (int row = 0; row < spr_h; row += 1) {
-        TR_CHK(tr_strcat_move_cursor(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx, x, y + row));
-
-        int spr_row_base = spr_x + (spr_y + row) * ss.width; // [spr_row_base] == [spr_y + row][spr_x]
-
-        for (int col = 0; col < spr_w; col += 1) {
-            int spr_idx = col + spr_row_base; // [spr_idx] == [spr_y + row][spr_x + col]
-
-            TR_CHK(tr_priv_emit_ansi(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx, &curr, ss, spr_idx));
-            TR_CHK(tr_priv_strcat(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx, ss.letter[spr_idx]));
-        }
-
-        if (curr.bg != TR_DEFAULT_COLOR_16) {
-            curr.bg = TR_DEFAULT_COLOR_16;
-            TR_CHK(tr_strcat_set_bg(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx, curr.bg));
-        }
-    }
-    TR_CHK(tr_strcat_reset_all(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx));
+    TR_CHK(tr_priv_strcat_spritesheet(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx, &tr_priv_generic_encoder, NULL, ss, NULL, NULL, NULL, spr_x, spr_y, spr_w, spr_h, x, y));
 
     raw_buf[raw_buf_idx] = '\0';
+    tr_priv_term_written(NULL);
     fputs(raw_buf, stdout);
 
     return TR_OK;
@@ -883,133 +2192,888 @@ TR_API TrResult tr_draw_text(const char *text, TrStyle style, int x, int y) {
     TR_CHK(tr_priv_strcat(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx, text));
 
     raw_buf[raw_buf_idx] = '\0';
+    tr_priv_term_written(NULL);
     fputs(raw_buf, stdout);
 
     return TR_OK;
 }
+TR_API TrResult tr_strcat_sprite(char *dst, size_t len, size_t *idx, TrCellSpan sprite, int x, int y, TrEncoder encoder) {
+    if (sprite.width <= 0 || sprite.height <= 0 || x < 0 || y < 0)
+        return TR_ERR_BAD_ARG;
+
+    TR_CHK(tr_priv_strcat_spritesheet(dst, len, idx, &encoder, NULL, sprite, NULL, NULL, NULL, 0, 0, sprite.width, sprite.height, x, y));
+
+    return TR_OK;
+}
 // ----------------------------------------------------------------------------
 // ============================================================================
 
-// Frame buffers
+#ifndef TR_NO_THREADS
+// Threads (private)
 // ============================================================================
-// Helper functions (private)
+// Atomics
 // ----------------------------------------------------------------------------
-static void tr_priv_get_visible(int *result_size, int *result_idx, int fb_size, int size, int pos) {
-    if (pos >= 0) {
-        if (pos + size < fb_size) {
-            *result_size = size;
-            *result_idx = 0;
-        } else {
-            *result_size = fb_size - pos;
-            *result_idx = 0;
-        }
-    } else {
-        if (pos + size > 0) {
-            *result_size = size + pos;
-            *result_idx = -pos;
-        }
-    }
+// clang-format off
+#if defined(__GNUC__) || defined(__clang__)
+static uint32_t tr_priv_atomic_load(uint32_t *p) {
+    return __atomic_load_n(p, __ATOMIC_ACQUIRE);
 }
-static int tr_priv_ctx_memcmp(const TrRenderContext *ctx, int idx, size_t len) { // Return values: -2 = entire row equal; -1 = difference detected; >=0 = index of the first cell in the region with a different letter.
-    if (idx < 0)
-        return -1;
-
-    if (memcmp(&ctx->front.effects[idx], &ctx->back.effects[idx], len * sizeof(TrEffect)) != 0)
-        return -1;
-
-    if (memcmp(&ctx->front.fg[idx], &ctx->back.fg[idx], len * sizeof(uint32_t)) != 0)
-        return -1;
+static void tr_priv_atomic_store(uint32_t *p, uint32_t v) {
+    __atomic_store_n(p, v, __ATOMIC_RELEASE);
+}
+static bool tr_priv_atomic_cas(uint32_t *p, uint32_t *expected, uint32_t desired) { // Updates `expected` on failure.
+    return __atomic_compare_exchange_n(p, expected, desired, false, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE);
+}
+#elif defined(_MSC_VER)
+    #include <intrin.h>
+static uint32_t tr_priv_atomic_load(uint32_t *p) {
+    return (uint32_t)_InterlockedOr((volatile long *)p, 0);
+}
+static void tr_priv_atomic_store(uint32_t *p, uint32_t v) {
+    _InterlockedExchange((volatile long *)p, (long)v);
+}
+static bool tr_priv_atomic_cas(uint32_t *p, uint32_t *expected, uint32_t desired) { // Updates `expected` on failure.
+    uint32_t old = (uint32_t)_InterlockedCompareExchange((volatile long *)p, (long)desired, (long)*expected);
+    if (old == *expected)
+        return true;
+    *expected = old;
+    return false;
+}
+#else
+    #error "TrCommandQueue needs GCC, Clang or MSVC atomics. Define TR_NO_THREADS to exclude it."
+#endif
+// clang-format on
+// ----------------------------------------------------------------------------
 
-    if (memcmp(&ctx->front.bg[idx], &ctx->back.bg[idx], len * sizeof(uint32_t)) != 0)
-        return -1;
+// Threads, mutexes and condition variables
+// ----------------------------------------------------------------------------
+// clang-format off
+#if defined(_WIN32) || defined(_WIN64)
+    #include <Windows.h>
 
-    for (int i = idx; i < idx + (int)len; i += 1) {
-        if (memcmp(&ctx->front.letter[i], &ctx->back.letter[i], TR_MAX_UTF8_LEN * sizeof(char)) != 0)
-            return i;
-    }
+typedef HANDLE TrPrivThread;
+typedef CRITICAL_SECTION TrPrivMutex;
+typedef CONDITION_VARIABLE TrPrivCond;
+    #define TR_PRIV_THREAD_FUNC(name, arg) static DWORD WINAPI name(LPVOID arg)
+    #define TR_PRIV_THREAD_RETURN return 0
 
-    return -2;
+static bool tr_priv_thread_start(TrPrivThread *t, LPTHREAD_START_ROUTINE fn, void *arg) {
+    *t = CreateThread(NULL, 0, fn, arg, 0, NULL);
+    return *t != NULL;
 }
-static bool tr_priv_ctx_cmp(const TrRenderContext *ctx, int idx) {
-    if (idx < 0)
-        return false;
+static void tr_priv_thread_join(TrPrivThread t) {
+    WaitForSingleObject(t, INFINITE);
+    CloseHandle(t);
+}
+static void tr_priv_mutex_init(TrPrivMutex *m) {
+    InitializeCriticalSection(m);
+}
+static void tr_priv_mutex_destroy(TrPrivMutex *m) {
+    DeleteCriticalSection(m);
+}
+static void tr_priv_mutex_lock(TrPrivMutex *m) {
+    EnterCriticalSection(m);
+}
+static void tr_priv_mutex_unlock(TrPrivMutex *m) {
+    LeaveCriticalSection(m);
+}
+static void tr_priv_cond_init(TrPrivCond *c) {
+    InitializeConditionVariable(c);
+}
+static void tr_priv_cond_destroy(TrPrivCond *c) {
+    (void)c;
+}
+static void tr_priv_cond_wait(TrPrivCond *c, TrPrivMutex *m) {
+    SleepConditionVariableCS(c, m, INFINITE);
+}
+static void tr_priv_cond_broadcast(TrPrivCond *c) {
+    WakeAllConditionVariable(c);
+}
+#else
+    #include <pthread.h>
 
-    if (ctx->front.effects[idx] != ctx->back.effects[idx])
-        return false;
+typedef pthread_t TrPrivThread;
+typedef pthread_mutex_t TrPrivMutex;
+typedef pthread_cond_t TrPrivCond;
+    #define TR_PRIV_THREAD_FUNC(name, arg) static void *name(void *arg)
+    #define TR_PRIV_THREAD_RETURN return NULL
 
-    if (ctx->front.fg[idx] != ctx->back.fg[idx])
-        return false;
+static bool tr_priv_thread_start(TrPrivThread *t, void *(*fn)(void *), void *arg) {
+    return pthread_create(t, NULL, fn, arg) == 0;
+}
+static void tr_priv_thread_join(TrPrivThread t) {
+    pthread_join(t, NULL);
+}
+static void tr_priv_mutex_init(TrPrivMutex *m) {
+    pthread_mutex_init(m, NULL);
+}
+static void tr_priv_mutex_destroy(TrPrivMutex *m) {
+    pthread_mutex_destroy(m);
+}
+static void tr_priv_mutex_lock(TrPrivMutex *m) {
+    pthread_mutex_lock(m);
+}
+static void tr_priv_mutex_unlock(TrPrivMutex *m) {
+    pthread_mutex_unlock(m);
+}
+static void tr_priv_cond_init(TrPrivCond *c) {
+    pthread_cond_init(c, NULL);
+}
+static void tr_priv_cond_destroy(TrPrivCond *c) {
+    pthread_cond_destroy(c);
+}
+static void tr_priv_cond_wait(TrPrivCond *c, TrPrivMutex *m) {
+    pthread_cond_wait(c, m);
+}
+static void tr_priv_cond_broadcast(TrPrivCond *c) {
+    pthread_cond_broadcast(c);
+}
+#endif
+// clang-format on
+// ----------------------------------------------------------------------------
+// ============================================================================
 
-    if (ctx->front.bg[idx] != ctx->back.bg[idx])
-        return false;
+// Async writer
+// ============================================================================
+// Helper functions (private)
+// ----------------------------------------------------------------------------
+typedef struct TrPrivAsyncWriter {
+    char buf[TR_ASYNC_WRITER_BUFFER_COUNT][TR_MAX_RAW_BUFFER_LEN];
+    size_t len[TR_ASYNC_WRITER_BUFFER_COUNT];
+    bool busy[TR_ASYNC_WRITER_BUFFER_COUNT]; // Being encoded, queued, or being written.
+    // What a queued frame needs to be taken back and replaced by a newer frame of the same context.
+    const void *owner[TR_ASYNC_WRITER_BUFFER_COUNT];
+    TrTerminalState term[TR_ASYNC_WRITER_BUFFER_COUNT]; // The terminal before the frame.
+    int damage[TR_ASYNC_WRITER_BUFFER_COUNT][4];        // x, y, width and height of the cells the frame drew.
+    int queue[TR_ASYNC_WRITER_BUFFER_COUNT]; // FIFO of buffer indices waiting to be written.
+    int queue_head, queue_len;
+    bool quit;
+    TrPrivThread thread;
+    TrPrivMutex mutex;
+    TrPrivCond cond; // Signaled whenever `busy`, `queue` or `quit` changes.
+} TrPrivAsyncWriter;
+
+TR_PRIV_THREAD_FUNC(tr_priv_aw_main, arg) {
+    TrPrivAsyncWriter *w = arg;
+
+    tr_priv_mutex_lock(&w->mutex);
+    for (;;) {
+        while (w->queue_len == 0 && !w->quit)
+            tr_priv_cond_wait(&w->cond, &w->mutex);
+        if (w->queue_len == 0) // `quit` and nothing left.
+            break;
+
+        int slot = w->queue[w->queue_head];
+
+        tr_priv_mutex_unlock(&w->mutex); // The buffer is owned by this thread until `busy` is cleared.
+        fwrite(w->buf[slot], 1, w->len[slot], stdout);
+        fflush(stdout);
+        tr_priv_mutex_lock(&w->mutex);
+
+        w->queue_head = (w->queue_head + 1) % TR_ASYNC_WRITER_BUFFER_COUNT;
+        w->queue_len -= 1;
+        w->busy[slot] = false;
+        tr_priv_cond_broadcast(&w->cond);
+    }
+    tr_priv_mutex_unlock(&w->mutex);
 
-    if (memcmp(&ctx->front.letter[idx], &ctx->back.letter[idx], TR_MAX_UTF8_LEN * sizeof(char)) != 0)
-        return false;
+    TR_PRIV_THREAD_RETURN;
+}
+static int tr_priv_aw_try_acquire(TrPrivAsyncWriter *w, const void *owner, bool *replaced) { // Returns the index of a free buffer. If every buffer is busy, takes back the newest queued frame of `owner` and sets `replaced`. -1 if neither.
+    int slot = -1;
+    *replaced = false;
+
+    tr_priv_mutex_lock(&w->mutex);
+    for (int i = 0; i < TR_ASYNC_WRITER_BUFFER_COUNT; i += 1) {
+        if (!w->busy[i]) {
+            slot = i;
+            w->busy[i] = true;
+            break;
+        }
+    }
+    if (slot < 0 && w->queue_len >= 2) { // Only the head of the queue is being written.
+        int last = w->queue[(w->queue_head + w->queue_len - 1) % TR_ASYNC_WRITER_BUFFER_COUNT];
+        if (w->owner[last] == owner) {
+            w->queue_len -= 1;
+            slot = last;
+            *replaced = true;
+        }
+    }
+    tr_priv_mutex_unlock(&w->mutex);
 
-    return true;
+    return slot;
+}
+static void tr_priv_aw_release(TrPrivAsyncWriter *w, int slot) { // Gives back an acquired buffer without writing it.
+    tr_priv_mutex_lock(&w->mutex);
+    w->busy[slot] = false;
+    tr_priv_cond_broadcast(&w->cond);
+    tr_priv_mutex_unlock(&w->mutex);
 }
-static void tr_priv_get_dirty_rect(int *x, int *y, int *width, int *height, const TrRenderContext *ctx) {
-    int left = ctx->width - 1;
-    int top = ctx->height - 1;
-    int right = 0;
-    int bottom = 0;
+static void tr_priv_aw_submit(TrPrivAsyncWriter *w, int slot, size_t len) {
+    tr_priv_mutex_lock(&w->mutex);
+    w->len[slot] = len;
+    w->queue[(w->queue_head + w->queue_len) % TR_ASYNC_WRITER_BUFFER_COUNT] = slot;
+    w->queue_len += 1;
+    tr_priv_cond_broadcast(&w->cond);
+    tr_priv_mutex_unlock(&w->mutex);
+}
+// ----------------------------------------------------------------------------
 
-    for (int row = 0; row < ctx->height; row += 1) {
-        int fb_row_base = 0 + row * ctx->width; // [fb_row_base] == [row][0]
+TR_API TrResult tr_aw_init(TrAsyncWriter *aw) {
+    TrPrivAsyncWriter *w = TR_MALLOC(sizeof(TrPrivAsyncWriter));
+    aw->priv = w;
+    if (w == NULL)
+        return TR_ERR_ALLOC_FAIL;
 
-        int res = tr_priv_ctx_memcmp(ctx, fb_row_base, (size_t)(ctx->width));
-        if (res == -2) // CASE 1: No differences found in the row.
-            continue;
+    for (int i = 0; i < TR_ASYNC_WRITER_BUFFER_COUNT; i += 1) {
+        w->len[i] = 0;
+        w->busy[i] = false;
+    }
+    w->queue_head = 0;
+    w->queue_len = 0;
+    w->quit = false;
+    tr_priv_mutex_init(&w->mutex);
+    tr_priv_cond_init(&w->cond);
+
+    if (!tr_priv_thread_start(&w->thread, tr_priv_aw_main, w)) {
+        tr_priv_cond_destroy(&w->cond);
+        tr_priv_mutex_destroy(&w->mutex);
+        TR_FREE(w);
+        aw->priv = NULL;
+        return TR_ERR_ALLOC_FAIL;
+    }
 
-        else if (res == -1) { // CASE 2: Differences found in effects, fg, bg.
-            for (int col = 0; col < ctx->width; col += 1) {
-                int fb_idx = col + fb_row_base; // [fb_idx] == [row][col]
+    return TR_OK;
+}
+TR_API void tr_aw_cleanup(TrAsyncWriter *aw) {
+    TrPrivAsyncWriter *w = aw->priv;
+    if (w == NULL)
+        return;
 
-                if (tr_priv_ctx_cmp(ctx, fb_idx))
-                    continue;
+    tr_priv_mutex_lock(&w->mutex);
+    w->quit = true;
+    tr_priv_cond_broadcast(&w->cond);
+    tr_priv_mutex_unlock(&w->mutex);
 
-                if (left > col)
-                    left = col;
-                if (right < col)
-                    right = col;
-            }
-        } else if (res >= 0) { // CASE 3: Differences found in letter.
-            int col = res % ctx->width;
-            if (left > col)
-                left = col;
-            if (right < col)
-                right = col;
-        }
-
-        if (top > row)
-            top = row;
-        if (bottom < row)
-            bottom = row;
-    }
-    if (left > right || top > bottom) {
-        *x = 0;
-        *y = 0;
-        *width = 0;
-        *height = 0;
+    tr_priv_thread_join(w->thread);
+    tr_priv_cond_destroy(&w->cond);
+    tr_priv_mutex_destroy(&w->mutex);
+    TR_FREE(w);
+    aw->priv = NULL;
+}
+TR_API void tr_aw_flush(TrAsyncWriter *aw) {
+    TrPrivAsyncWriter *w = aw->priv;
+    if (w == NULL)
+        return;
+
+    tr_priv_mutex_lock(&w->mutex);
+    while (w->queue_len > 0)
+        tr_priv_cond_wait(&w->cond, &w->mutex);
+    tr_priv_mutex_unlock(&w->mutex);
+}
+TR_API void tr_ctx_set_writer(TrRenderContext *ctx, TrAsyncWriter *writer) {
+    ctx->writer = writer;
+}
+// ============================================================================
+#endif // TR_NO_THREADS
+
+// Frame buffers
+// ============================================================================
+// Helper functions (private)
+// ----------------------------------------------------------------------------
+enum { // Record types of a trace. Each is followed by its arguments as varints.
+    TR_PRIV_REC_CLEAR = 1,
+    TR_PRIV_REC_RECT,
+    TR_PRIV_REC_SPRITE,
+    TR_PRIV_REC_TEXT,
+    TR_PRIV_REC_RENDER,
+    TR_PRIV_REC_VIEWPORT,
+    TR_PRIV_REC_SPRITE_TRANSFORMED,
+    TR_PRIV_REC_SPRITE_BLENDED,
+    TR_PRIV_REC_RECT_BLENDED,
+    TR_PRIV_REC_IMAGE,
+    TR_PRIV_REC_HLINE,
+    TR_PRIV_REC_VLINE,
+    TR_PRIV_REC_SCROLL,
+    TR_PRIV_REC_INVALIDATE,
+    TR_PRIV_REC_RESIZE,
+    TR_PRIV_REC_FORGET_TERMINAL,
+    TR_PRIV_REC_RESET_GRAPHEMES,
+    TR_PRIV_REC_TOLERANCE,
+    TR_PRIV_REC_ENCODER,
+    TR_PRIV_REC_CAPS,
+    TR_PRIV_REC_STYLE_TABLE,
+    TR_PRIV_REC_LAZY_CLEAR,
+};
+static void tr_priv_rec_bytes(TrRecorder *rec, const void *data, size_t len) {
+    if (rec->error != TR_OK || len == 0)
         return;
+
+    if (fwrite(data, 1, len, (FILE *)rec->file) != len)
+        rec->error = TR_ERR_IO;
+}
+static void tr_priv_rec_uint(TrRecorder *rec, uint32_t value) { // LEB128, so small values take a byte.
+    uint8_t buf[5];
+    size_t n = 0;
+    do {
+        buf[n] = (uint8_t)(value & 0x7F);
+        value >>= 7;
+        if (value != 0)
+            buf[n] |= 0x80;
+        n += 1;
+    } while (value != 0);
+
+    tr_priv_rec_bytes(rec, buf, n);
+}
+static void tr_priv_rec_int(TrRecorder *rec, int value) { // Zigzag, so small negative values stay small.
+    tr_priv_rec_uint(rec, value < 0 ? ((uint32_t)(-(value + 1)) << 1) | 1 : (uint32_t)value << 1);
+}
+static void tr_priv_rec_type(TrRecorder *rec, int type) {
+    uint8_t b = (uint8_t)type;
+    tr_priv_rec_bytes(rec, &b, 1);
+}
+static void tr_priv_rec_unrecordable(TrRecorder *rec) { // Stops the trace, since replaying it would differ from what was drawn.
+    if (rec->error == TR_OK)
+        rec->error = TR_ERR_UNRECORDABLE;
+}
+static void tr_priv_rec_letter(TrRecorder *rec, const TrGraphemePool *pool, const char *letter) { // Grapheme ids are recorded as their bytes.
+    size_t len = 0;
+    const char *bytes = tr_priv_letter(pool, letter, &len);
+
+    tr_priv_rec_uint(rec, (uint32_t)len);
+    tr_priv_rec_bytes(rec, bytes, len);
+}
+static void tr_priv_rec_encoder(TrRecorder *rec, TrEncoder encoder) { // Built-in encoders are recorded as the arguments of `tr_encoder`. Others cannot be.
+    for (int colors = TR_ENCODER_GENERIC; colors <= TR_ENCODER_16; colors += 1) {
+        for (int effects = 0; effects < 2; effects += 1) {
+            TrEncoder e = tr_encoder((TrEncoderColors)colors, effects != 0);
+            if (e.set_fg != encoder.set_fg || e.set_bg != encoder.set_bg || e.set_effects != encoder.set_effects)
+                continue;
+
+            tr_priv_rec_type(rec, TR_PRIV_REC_ENCODER);
+            tr_priv_rec_uint(rec, (uint32_t)colors);
+            tr_priv_rec_uint(rec, (uint32_t)effects);
+            tr_priv_rec_uint(rec, encoder.caps);
+            return;
+        }
     }
-    *x = left;
-    *y = top;
-    *width = right - left + 1;
-    *height = bottom - top + 1;
+    tr_priv_rec_unrecordable(rec);
 }
-static void tr_priv_ctx_swap(TrRenderContext *ctx) {
-    size_t len = (size_t)(ctx->width * ctx->height);
+static void tr_priv_rec_style(TrRecorder *rec, TrStyle style) {
+    tr_priv_rec_uint(rec, (uint32_t)style.effects);
+    tr_priv_rec_uint(rec, style.fg);
+    tr_priv_rec_uint(rec, style.bg);
+}
+static void tr_priv_rec_cells(TrRecorder *rec, const TrGraphemePool *pool, TrCellSpan cells, int base, size_t len) { // Records `len` cells from `base` of `cells`.
+    for (size_t i = 0; i < len; i += 1) {
+        tr_priv_rec_letter(rec, pool, cells.letter[base + i]);
+        tr_priv_rec_uint(rec, (uint32_t)cells.effects[base + i]);
+        tr_priv_rec_uint(rec, cells.fg[base + i]);
+        tr_priv_rec_uint(rec, cells.bg[base + i]);
+    }
+}
+static void tr_priv_rec_sprite(TrRecorder *rec, int type, const TrGraphemePool *pool, TrCellSpan sprite, int x, int y) { // Arguments that follow the sprite are recorded by the caller.
+    tr_priv_rec_type(rec, type);
+    tr_priv_rec_int(rec, x);
+    tr_priv_rec_int(rec, y);
+    tr_priv_rec_int(rec, sprite.width);
+    tr_priv_rec_int(rec, sprite.height);
+    if (sprite.width <= 0 || sprite.height <= 0)
+        return;
+
+    tr_priv_rec_cells(rec, pool, sprite, 0, (size_t)sprite.width * (size_t)sprite.height);
+}
+static void tr_priv_ctx_to_clip(const TrRenderContext *ctx, int *x, int *y) { // Makes a position of the viewport relative to its clip rectangle, so it is clipped like one of the context.
+    *x += ctx->viewport.x - ctx->viewport.clip_x;
+    *y += ctx->viewport.y - ctx->viewport.clip_y;
+}
+#define TR_PRIV_MAX_SHADE_THREADS 16
+
+typedef struct TrPrivShadeJob { // Rows [row_begin, row_end) of a `tr_ctx_shade` call.
+    TrRenderContext *ctx;
+    TrShader shader;
+    void *user;
+    int x, y, width;
+    int fb_base;
+    int row_begin, row_end;
+} TrPrivShadeJob;
+
+static void tr_priv_shade_rows(const TrPrivShadeJob *job) {
+    TrFramebufferBase *back = &job->ctx->back;
+
+    for (int row = job->row_begin; row < job->row_end; row += 1) {
+        int fb_row_base = job->fb_base + row * job->ctx->width; // [fb_row_base] == [y + row][x]
+        TrShadeRow r = {
+            .x = job->x,
+            .y = job->y + row,
+            .width = job->width,
+            .letter = &back->letter[fb_row_base],
+            .effects = &back->effects[fb_row_base],
+            .fg = &back->fg[fb_row_base],
+            .bg = &back->bg[fb_row_base],
+        };
+        job->shader(&r, job->user);
+    }
+}
+#ifndef TR_NO_THREADS
+TR_PRIV_THREAD_FUNC(tr_priv_shade_main, arg) {
+    tr_priv_shade_rows((const TrPrivShadeJob *)arg);
+    TR_PRIV_THREAD_RETURN;
+}
+#endif
+static int tr_priv_ctx_base(const TrRenderContext *ctx, int x, int y) { // Index of the first visible cell of a draw at (x, y) relative to the clip rectangle.
+    return ctx->viewport.clip_x + (x > 0 ? x : 0) + (ctx->viewport.clip_y + (y > 0 ? y : 0)) * ctx->width;
+}
+static void tr_priv_get_visible(int *result_size, int *result_idx, int fb_size, int size, int pos) {
+    if (pos >= 0) {
+        if (pos + size < fb_size) {
+            *result_size = size;
+            *result_idx = 0;
+        } else {
+            *result_size = fb_size - pos;
+            *result_idx = 0;
+        }
+    } else {
+        if (pos + size > 0) {
+            *result_size = (pos + size < fb_size ? pos + size : fb_size);
+            *result_idx = -pos;
+        }
+    }
+}
+static bool tr_priv_ctx_has_ids(const TrRenderContext *ctx) { // Checks if every cell has a valid style id, so equal ids mean equal styles.
+    return ctx->style_table && !ctx->styles->overflow;
+}
+static int tr_priv_ctx_memcmp(const TrRenderContext *ctx, const TrFramebufferBase *back, int idx, size_t len) { // Compares `back` with `front`. Return values: -2 = entire row equal; -1 = difference detected.
+    if (idx < 0)
+        return -1;
+
+    if (tr_priv_ctx_has_ids(ctx)) {
+        if (memcmp(&ctx->front.style[idx], &back->style[idx], len * sizeof(uint16_t)) != 0)
+            return -1;
+        if (memcmp(&ctx->front.letter[idx], &back->letter[idx], len * TR_MAX_UTF8_LEN) != 0)
+            return -1;
+
+        return -2;
+    }
+
+    if (memcmp(&ctx->front.effects[idx], &back->effects[idx], len * sizeof(TrEffect)) != 0)
+        return -1;
+
+    if (memcmp(&ctx->front.fg[idx], &back->fg[idx], len * sizeof(uint32_t)) != 0)
+        return -1;
+
+    if (memcmp(&ctx->front.bg[idx], &back->bg[idx], len * sizeof(uint32_t)) != 0)
+        return -1;
+
+    if (memcmp(&ctx->front.letter[idx], &back->letter[idx], len * TR_MAX_UTF8_LEN) != 0)
+        return -1;
+
+    return -2;
+}
+static bool tr_priv_color_close(uint32_t a, uint32_t b, int tolerance) { // Checks if the redmean distance of two true colors is below `tolerance`.
+    if (a == b)
+        return true;
+
+    if (tolerance <= 0 || tr_color_mode(a) != TR_COLOR_TRUE || tr_color_mode(b) != TR_COLOR_TRUE)
+        return false;
+
+    int r_mean = (tr_rgb_r(a) + tr_rgb_r(b)) / 2;
+    int dr = tr_rgb_r(a) - tr_rgb_r(b);
+    int dg = tr_rgb_g(a) - tr_rgb_g(b);
+    int db = tr_rgb_b(a) - tr_rgb_b(b);
+    int dist_sq = (((512 + r_mean) * dr * dr) >> 8) + 4 * dg * dg + (((767 - r_mean) * db * db) >> 8);
+
+    return dist_sq < tolerance * tolerance;
+}
+static bool tr_priv_ctx_cmp(const TrRenderContext *ctx, const TrFramebufferBase *back, int idx) {
+    if (idx < 0)
+        return false;
+
+    if (ctx->tolerance == 0 && tr_priv_ctx_has_ids(ctx))
+        return ctx->front.style[idx] == back->style[idx] && memcmp(&ctx->front.letter[idx], &back->letter[idx], TR_MAX_UTF8_LEN) == 0;
+
+    if (ctx->front.effects[idx] != back->effects[idx])
+        return false;
+
+    if (!tr_priv_color_close(ctx->front.fg[idx], back->fg[idx], ctx->tolerance))
+        return false;
+
+    if (!tr_priv_color_close(ctx->front.bg[idx], back->bg[idx], ctx->tolerance))
+        return false;
+
+    if (memcmp(&ctx->front.letter[idx], &back->letter[idx], TR_MAX_UTF8_LEN * sizeof(char)) != 0)
+        return false;
+
+    return true;
+}
+#define TR_PRIV_SPAN_GAP 4 // Clean gaps up to this many cells are redrawn instead of moving the cursor over them.
+
+static bool tr_priv_ctx_next_span(const TrRenderContext *ctx, const TrFramebufferBase *back, int fb_row_base, int *col, int *start, int *end) { // Finds the next span of dirty cells in a row from `*col`. Returns false if there is none.
+    int c = *col;
+    while (c < ctx->width && tr_priv_ctx_cmp(ctx, back, fb_row_base + c))
+        c += 1;
+    if (c >= ctx->width)
+        return false;
+
+    int first = c;
+    int last = c; // Last dirty cell of the span.
+    for (c += 1; c < ctx->width && c - last <= TR_PRIV_SPAN_GAP; c += 1) {
+        if (!tr_priv_ctx_cmp(ctx, back, fb_row_base + c))
+            last = c;
+    }
+
+    *start = first;
+    *end = last + 1;
+    *col = last + 1;
+    return true;
+}
+#define TR_PRIV_MOVE_COST 4 // Typical length of a cursor movement inside a row in bytes, e.g. "\x1b[5C".
+
+static size_t tr_priv_ctx_cell_cost(const TrRenderContext *ctx) { // Bytes per drawn cell in the last render without cursor movements. Style changes are included, so it depends on the content.
+    size_t moves = (size_t)(ctx->stats.full_redraw ? (uint32_t)ctx->height : ctx->stats.spans) * TR_PRIV_MOVE_COST;
+    if (ctx->stats.cells == 0 || ctx->stats.bytes <= moves + ctx->stats.cells)
+        return 1;
+
+    return (ctx->stats.bytes - moves) / ctx->stats.cells;
+}
+static bool tr_priv_ctx_plan_full(const TrRenderContext *ctx, size_t cell_cost, uint32_t dirty, uint32_t spans) { // Estimates whether drawing every cell is shorter than drawing the dirty spans of this frame.
+    size_t cells = (size_t)ctx->width * (size_t)ctx->height;
+    size_t spans_cost = (size_t)dirty * cell_cost + (size_t)spans * TR_PRIV_MOVE_COST;
+    size_t full_cost = cells * cell_cost + (size_t)ctx->height * TR_PRIV_MOVE_COST;
+
+    return dirty > 0 && full_cost <= spans_cost; // On a tie, drawing every cell is still cheaper for the CPU.
+}
+#define TR_PRIV_NO_STYLE 0xFFFF
+#define TR_PRIV_STYLE_SLOTS (TR_MAX_STYLES * 2)
+
+typedef struct TrPrivStyleBlock { // What `tr_ctx_set_style_table` allocates.
+    TrStyleTable table; // First, so a pointer to it frees the block.
+    uint16_t front[TR_MAX_FRAMEBUFFER_LEN], back[TR_MAX_FRAMEBUFFER_LEN];
+} TrPrivStyleBlock;
+
+static void tr_priv_style_reset(TrStyleTable *t) {
+    memset(t->slots, 0, sizeof(t->slots));
+    t->count = 0;
+    t->overflow = false;
+}
+static uint16_t tr_priv_style_intern(TrStyleTable *t, const TrEncoder *enc, TrEffect effects, uint32_t fg, uint32_t bg) { // Returns the id of a style and adds it if it is new. Returns TR_PRIV_NO_STYLE if the table is full.
+    uint32_t h = (fg * 0x9E3779B1u) ^ (bg * 0x85EBCA77u) ^ ((uint32_t)effects * 0xC2B2AE3Du);
+    size_t slot = (size_t)(h ^ (h >> 16)) % TR_PRIV_STYLE_SLOTS;
+
+    while (t->slots[slot] != 0) { // The table is at most half full, so this ends.
+        uint16_t id = (uint16_t)(t->slots[slot] - 1);
+        const TrStyle *e = &t->styles[id];
+        if (e->effects == effects && e->fg == fg && e->bg == bg)
+            return id;
+
+        slot = (slot + 1) % TR_PRIV_STYLE_SLOTS;
+    }
+
+    if (t->count >= TR_MAX_STYLES) {
+        t->overflow = true;
+        return TR_PRIV_NO_STYLE;
+    }
+
+    uint16_t id = (uint16_t)t->count;
+    t->count += 1;
+    t->slots[slot] = (uint16_t)(id + 1);
+    t->styles[id] = (TrStyle){.effects = effects, .fg = fg, .bg = bg};
+
+    size_t n = 0;
+    if (enc->set_fg(t->fg_ansi[id], sizeof(t->fg_ansi[id]), &n, fg) != TR_OK)
+        n = 0;
+    t->fg_len[id] = (uint8_t)n;
+
+    n = 0;
+    if (enc->set_bg(t->bg_ansi[id], sizeof(t->bg_ansi[id]), &n, bg) != TR_OK)
+        n = 0;
+    t->bg_len[id] = (uint8_t)n;
+
+    return id;
+}
+#define TR_PRIV_GRAPHEME_SLOTS (TR_MAX_GRAPHEMES * 2)
+
+static void tr_priv_grapheme_reset(TrGraphemePool *p) {
+    memset(p->slots, 0, sizeof(p->slots));
+    p->count = 0;
+    p->used = 0;
+}
+static int tr_priv_grapheme_intern(TrGraphemePool *p, const char *text, size_t len) { // Returns the id of a cluster and adds it if it is new. Returns -1 if the pool is full.
+    uint32_t h = 2166136261u; // FNV-1a
+    for (size_t i = 0; i < len; i += 1) {
+        h = (h ^ (uint8_t)text[i]) * 16777619u;
+    }
+    size_t slot = (size_t)h % TR_PRIV_GRAPHEME_SLOTS;
+
+    while (p->slots[slot] != 0) { // The table is at most half full, so this ends.
+        int id = p->slots[slot] - 1;
+        if (p->len[id] == len && memcmp(&p->bytes[p->offset[id]], text, len) == 0)
+            return id;
+
+        slot = (slot + 1) % TR_PRIV_GRAPHEME_SLOTS;
+    }
+
+    if (p->count >= TR_MAX_GRAPHEMES || p->used + len > TR_MAX_GRAPHEME_BYTES)
+        return -1;
+
+    int id = p->count;
+    p->count += 1;
+    p->slots[slot] = (uint16_t)(id + 1);
+    p->offset[id] = (uint32_t)p->used;
+    p->len[id] = (uint8_t)len;
+    memcpy(&p->bytes[p->used], text, len);
+    p->used += len;
+
+    return id;
+}
+static void tr_priv_style_cells(TrStyleTable *t, const TrEncoder *enc, TrFramebufferBase *fb, int idx, int len) { // Writes the style ids of cells of `fb`.
+    // Neighbouring cells mostly share a style, so the last one is remembered.
+    TrEffect effects = TR_DEFAULT_EFFECT;
+    uint32_t fg = 0, bg = 0;
+    uint16_t id = TR_PRIV_NO_STYLE;
+    bool known = false;
+
+    for (int i = idx; i < idx + len; i += 1) {
+        if (!known || fb->effects[i] != effects || fb->fg[i] != fg || fb->bg[i] != bg) {
+            effects = fb->effects[i];
+            fg = fb->fg[i];
+            bg = fb->bg[i];
+            id = tr_priv_style_intern(t, enc, effects, fg, bg);
+            known = true;
+        }
+        fb->style[i] = id;
+    }
+}
+static void tr_priv_ctx_restyle(TrRenderContext *ctx, TrFramebufferBase *fb, int idx, int len) { // Updates style ids of cells that were written.
+    if (ctx->style_table)
+        tr_priv_style_cells(ctx->styles, &ctx->encoder, fb, idx, len);
+}
+static void tr_priv_ctx_rebuild_styles(TrRenderContext *ctx) { // Drops styles that are no longer used. Ids of both framebuffers are recomputed.
+    int len = ctx->width * ctx->height;
+
+    tr_priv_style_reset(ctx->styles);
+    tr_priv_ctx_restyle(ctx, &ctx->front, 0, len);
+    tr_priv_ctx_restyle(ctx, &ctx->back, 0, len);
+}
+static void tr_priv_ctx_touch(TrRenderContext *ctx, int idx, int len) { // Marks cells that are about to be fully overwritten as drawn since the last clear.
+    if (!ctx->lazy_clear)
+        return;
+
+    for (int i = idx; i < idx + len; i += 1) {
+        ctx->gen[i] = ctx->clear_gen;
+    }
+}
+static void tr_priv_ctx_resolve(TrRenderContext *ctx, int idx, int len) { // Writes the cleared value to cells that are not drawn since the last clear.
+    if (!ctx->lazy_clear)
+        return;
+
+    int i = idx;
+    while (i < idx + len) {
+        if (ctx->gen[i] == ctx->clear_gen) {
+            i += 1;
+            continue;
+        }
+
+        int run = i; // Clear a whole run of stale cells at once.
+        while (run < idx + len && ctx->gen[run] != ctx->clear_gen) {
+            ctx->gen[run] = ctx->clear_gen;
+            run += 1;
+        }
+        size_t run_len = (size_t)(run - i);
+
+        tr_priv_fill_letter(&ctx->back.letter[i], " ", run_len);
+        tr_priv_fill_effects(&ctx->back.effects[i], TR_DEFAULT_EFFECT, run_len);
+        tr_priv_fill_32(&ctx->back.fg[i], TR_DEFAULT_COLOR_16, run_len);
+        tr_priv_fill_32(&ctx->back.bg[i], ctx->clear_bg, run_len);
+        tr_priv_ctx_restyle(ctx, &ctx->back, i, (int)run_len);
+        i = run;
+    }
+}
+static void tr_priv_ctx_invalidate_front(TrRenderContext *ctx, int x, int y, int width, int height) { // Makes the cells of `front` never match `back`. The area must be inside the context.
+    for (int row = y; row < y + height; row += 1) {
+        int fb_row_base = x + row * ctx->width; // [fb_row_base] == [row][x]
+
+        // No UTF-8 sequence contains 0xFF, so these cells never match `back`.
+        tr_priv_fill_letter(&ctx->front.letter[fb_row_base], "\xff\xff\xff", (size_t)width);
+        if (ctx->front.style != NULL)
+            memset(&ctx->front.style[fb_row_base], 0xFF, (size_t)width * sizeof(uint16_t));
+    }
+}
+static char *tr_priv_ctx_acquire_output(TrRenderContext *ctx, char *sync_buf, int *slot) { // Returns the buffer to encode a frame into, or NULL if the writer has no free buffer.
+    *slot = -1;
+#ifndef TR_NO_THREADS
+    if (ctx->writer != NULL && !ctx->headless) {
+        TrPrivAsyncWriter *w = ctx->writer->priv;
+        bool replaced = false;
+
+        *slot = tr_priv_aw_try_acquire(w, ctx, &replaced);
+        if (replaced) { // Its bytes are dropped, so this frame draws its cells again from the terminal it started with.
+            const int *d = w->damage[*slot];
+            int width = d[0] + d[2] < ctx->width ? d[2] : ctx->width - d[0]; // The context may have shrunk since.
+            int height = d[1] + d[3] < ctx->height ? d[3] : ctx->height - d[1];
+
+            if (width > 0 && height > 0)
+                tr_priv_ctx_invalidate_front(ctx, d[0], d[1], width, height);
+            ctx->term = w->term[*slot];
+            ctx->stats.coalesced = true;
+            ctx->stats.coalesced_count += 1;
+        }
+        return *slot >= 0 ? w->buf[*slot] : NULL;
+    }
+#else
+    (void)ctx;
+#endif
+    return sync_buf;
+}
+static void tr_priv_ctx_release_output(TrRenderContext *ctx, int slot) {
+#ifndef TR_NO_THREADS
+    if (slot >= 0)
+        tr_priv_aw_release(ctx->writer->priv, slot);
+#else
+    (void)ctx;
+    (void)slot;
+#endif
+}
+static void tr_priv_ctx_submit_output(TrRenderContext *ctx, char *buf, int slot, size_t len, const TrTerminalState *start, const int damage[4]) { // `start` is the terminal before the frame and `damage` the area it drew, in case a newer frame replaces it.
+#ifndef TR_NO_THREADS
+    if (slot >= 0) {
+        TrPrivAsyncWriter *w = ctx->writer->priv;
+
+        tr_priv_term_written(ctx);
+        w->owner[slot] = ctx;
+        w->term[slot] = *start;
+        memcpy(w->damage[slot], damage, sizeof(w->damage[slot]));
+        tr_priv_aw_submit(w, slot, len);
+        return;
+    }
+#else
+    (void)slot;
+    (void)start;
+    (void)damage;
+#endif
+    if (ctx->headless)
+        return;
+
+    tr_priv_term_written(ctx);
+    buf[len] = '\0';
+    fputs(buf, stdout);
+}
+static void tr_priv_ctx_swap(TrRenderContext *ctx, const TrFramebufferBase *back, int x, int y, int width, int height) { // Copies the rendered rectangle of `back` to `front`. Cells outside of it are not on the screen.
+    size_t len = (size_t)width;
+
+    for (int row = y; row < y + height; row += 1) {
+        int fb_idx = x + row * ctx->width; // [fb_idx] == [row][x]
+
+        memcpy(&ctx->front.letter[fb_idx], &back->letter[fb_idx], len * TR_MAX_UTF8_LEN);
+        memcpy(&ctx->front.effects[fb_idx], &back->effects[fb_idx], len * sizeof(TrEffect));
+        memcpy(&ctx->front.fg[fb_idx], &back->fg[fb_idx], len * sizeof(uint32_t));
+        memcpy(&ctx->front.bg[fb_idx], &back->bg[fb_idx], len * sizeof(uint32_t));
+        if (ctx->style_table)
+            memcpy(&ctx->front.style[fb_idx], &back->style[fb_idx], len * sizeof(uint16_t));
+    }
+}
+#ifndef TR_NO_THREADS
+#define TR_PRIV_PIPE_MAX_RECTS 16 // Invalidated areas a frame of a pipeline carries. More are merged into the last one.
+
+typedef struct TrPrivPipeRequests { // What the context of a pipeline asked for with a frame, besides the frame itself.
+    int x, y, width, height;
+    int tolerance;
+    bool headless, style_table;
+    TrEncoder encoder;
+    struct TrAsyncWriter *writer;
+    int scroll_y, scroll_h, scroll_n;
+    bool forget;                          // The terminal state was forgotten.
+    int rect_count;
+    int rects[TR_PRIV_PIPE_MAX_RECTS][4]; // x, y, width and height of each invalidated area, after the scroll.
+} TrPrivPipeRequests;
+
+typedef struct TrPrivPipeFrame { // A submitted frame. Owned by the thread while it is queued or rendered.
+    TrFramebufferBase back;
+    uint16_t ids[TR_MAX_FRAMEBUFFER_LEN]; // Style ids of `back`, given by the thread.
+    TrGraphemePool graphemes; // Without the hash table. Rendering only looks clusters up by id.
+    TrPrivPipeRequests req;
+} TrPrivPipeFrame;
+
+typedef struct TrPrivPipeline {
+    TrRenderContext ctx;        // Renders the frames with its own `front`, terminal state and style table. Only the thread uses it while it runs.
+    TrStyleTable styles;        // Style table of `ctx`. Its own framebuffers have no ids.
+    TrGraphemePool graphemes;   // Grapheme pool of `ctx`, copied from each frame.
+    TrPrivPipeFrame frames[2];  // `tr_ctx_submit` fills one while the thread renders the other.
+    TrPrivPipeFrame *queued;    // Next frame to render, or NULL.
+    TrPrivPipeFrame *rendering; // Frame the thread renders, or NULL.
+    TrResult result;            // Result of the last rendered frame.
+    TrRenderStats stats;        // Stats of the last rendered frame.
+    bool quit;
+    int rect_count;             // Areas invalidated on the context since the last submit. Only its thread uses them.
+    int rects[TR_PRIV_PIPE_MAX_RECTS][4];
+    TrPrivThread thread;
+    TrPrivMutex mutex;
+    TrPrivCond cond; // Signaled whenever `queued`, `rendering` or `quit` changes.
+} TrPrivPipeline;
+
+static void tr_priv_pipe_invalidate(TrPrivPipeline *p, int x, int y, int width, int height) { // Adds an area to invalidate with the next frame.
+    if (p->rect_count < TR_PRIV_PIPE_MAX_RECTS) {
+        int *r = p->rects[p->rect_count];
+        r[0] = x, r[1] = y, r[2] = width, r[3] = height;
+        p->rect_count += 1;
+        return;
+    }
+
+    int *r = p->rects[TR_PRIV_PIPE_MAX_RECTS - 1]; // Redrawing more cells than needed is still correct.
+    int right = r[0] + r[2] > x + width ? r[0] + r[2] : x + width;
+    int bottom = r[1] + r[3] > y + height ? r[1] + r[3] : y + height;
+    r[0] = r[0] < x ? r[0] : x;
+    r[1] = r[1] < y ? r[1] : y;
+    r[2] = right - r[0];
+    r[3] = bottom - r[1];
+}
+static void tr_priv_pipe_scroll(TrPrivPipeline *p, int y, int height, int n) { // Moves invalidated areas with a scroll, since the thread applies them after it.
+    for (int i = 0; i < p->rect_count; i += 1) {
+        int *r = p->rects[i];
+        if (r[1] >= y + height || r[1] + r[3] <= y || r[1] < y)
+            continue;
 
-    memcpy(ctx->front.letter, ctx->back.letter, len * sizeof(char));
-    memcpy(ctx->front.effects, ctx->back.effects, len * sizeof(TrEffect));
-    memcpy(ctx->front.fg, ctx->back.fg, len * sizeof(uint32_t));
-    memcpy(ctx->front.bg, ctx->back.bg, len * sizeof(uint32_t));
+        int top = r[1] - n > y ? r[1] - n : y; // Rows that moved up. The rows they left are kept, which redraws a few more.
+        r[3] += r[1] - top;
+        r[1] = top;
+    }
 }
+#endif
 // ----------------------------------------------------------------------------
 
 // Double-buffering renderer
 // ----------------------------------------------------------------------------
+static void tr_priv_ctx_forget_terminal(TrRenderContext *ctx) { // `tr_ctx_forget_terminal` without recording it, for calls that are recorded themselves.
+    ctx->term.style = tr_default_style();
+    ctx->term.cursor_x = -1;
+    ctx->term.cursor_y = -1;
+    ctx->term.known = false;
+}
+static void tr_priv_ctx_invalidate(TrRenderContext *ctx, int x, int y, int width, int height) { // `tr_ctx_invalidate` without recording it.
+    if (width <= 0 || height <= 0)
+        return;
+
+    int visible_cols = 0;
+    int _0 = 0; // placeholder
+    tr_priv_get_visible(&visible_cols, &_0, ctx->width, width, x);
+    int visible_rows = 0;
+    int _1 = 0; // placeholder
+    tr_priv_get_visible(&visible_rows, &_1, ctx->height, height, y);
+
+#ifndef TR_NO_THREADS
+    if (ctx->pipeline != NULL) { // The pipeline has the screen. It invalidates the area with the next frame.
+        if (visible_cols > 0 && visible_rows > 0)
+            tr_priv_pipe_invalidate(ctx->pipeline->priv, x > 0 ? x : 0, y > 0 ? y : 0, visible_cols, visible_rows);
+        tr_priv_ctx_forget_terminal(ctx);
+        return;
+    }
+#endif
+    if (visible_cols > 0 && visible_rows > 0)
+        tr_priv_ctx_invalidate_front(ctx, x > 0 ? x : 0, y > 0 ? y : 0, visible_cols, visible_rows);
+
+    // Whoever wrote there may have changed the style and the cursor too.
+    tr_priv_ctx_forget_terminal(ctx);
+}
 TR_API TrResult tr_ctx_init(TrRenderContext *ctx, int x, int y, int width, int height) {
     if (x < 0 || y < 0 || width <= 0 || height <= 0 || (width * height > TR_MAX_FRAMEBUFFER_LEN)) {
         ctx->x = 0;
@@ -1023,6 +3087,28 @@ TR_API TrResult tr_ctx_init(TrRenderContext *ctx, int x, int y, int width, int h
     ctx->y = y;
     ctx->width = width;
     ctx->height = height;
+    ctx->stats = (TrRenderStats){0};
+    ctx->tolerance = 0;
+    ctx->scroll_y = 0;
+    ctx->scroll_h = 0;
+    ctx->scroll_n = 0;
+    ctx->lazy_clear = false;
+    ctx->style_table = false;
+    ctx->styles = NULL;
+    ctx->front.style = NULL;
+    ctx->back.style = NULL;
+    ctx->graphemes = NULL;
+    ctx->encoder = tr_priv_generic_encoder;
+    tr_priv_ctx_forget_terminal(ctx);
+    ctx->clear_gen = 0;
+    ctx->clear_bg = TR_DEFAULT_COLOR_16;
+    ctx->headless = false;
+    ctx->viewport = tr_viewport(0, 0, width, height);
+    ctx->recorder = NULL;
+#ifndef TR_NO_THREADS
+    ctx->writer = NULL;
+    ctx->pipeline = NULL;
+#endif
 
     tr_fill_buf(tr_ftos(&ctx->front, width, height), TR_DEFAULT_COLOR_16);
     tr_fill_buf(tr_ftos(&ctx->back, width, height), TR_DEFAULT_COLOR_16);
@@ -1030,135 +3116,1504 @@ TR_API TrResult tr_ctx_init(TrRenderContext *ctx, int x, int y, int width, int h
     return TR_OK;
 }
 TR_API void tr_ctx_clear(TrRenderContext *ctx, uint32_t bg) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_CLEAR);
+        tr_priv_rec_uint(ctx->recorder, bg);
+    }
+
+    if (ctx->lazy_clear) {
+        ctx->clear_gen += 1;
+        ctx->clear_bg = bg;
+        if (ctx->clear_gen != 0)
+            return;
+        // The generation wrapped around, so old cells could look fresh. Clear eagerly once.
+        memset(ctx->gen, 0, sizeof(ctx->gen));
+    }
     tr_fill_buf(tr_ftos(&ctx->back, ctx->width, ctx->height), bg);
+    tr_priv_ctx_restyle(ctx, &ctx->back, 0, ctx->width * ctx->height);
 }
-TR_API TrResult tr_ctx_render(TrRenderContext *ctx) {
-    int dirty_rect_x = 0, dirty_rect_y = 0;
-    int dirty_rect_w = 0, dirty_rect_h = 0;
-    tr_priv_get_dirty_rect(&dirty_rect_x, &dirty_rect_y, &dirty_rect_w, &dirty_rect_h, ctx);
-    if (dirty_rect_w <= 0 || dirty_rect_h <= 0)
+TR_API TrViewport tr_viewport(int x, int y, int width, int height) {
+    return (TrViewport){.x = x, .y = y, .clip_x = x, .clip_y = y, .clip_w = width, .clip_h = height};
+}
+TR_API TrViewport tr_viewport_sub(TrViewport parent, int x, int y, int width, int height) {
+    TrViewport vp = tr_viewport(parent.x + x, parent.y + y, width, height);
+
+    int x0 = vp.clip_x > parent.clip_x ? vp.clip_x : parent.clip_x;
+    int y0 = vp.clip_y > parent.clip_y ? vp.clip_y : parent.clip_y;
+    int x1 = vp.clip_x + vp.clip_w < parent.clip_x + parent.clip_w ? vp.clip_x + vp.clip_w : parent.clip_x + parent.clip_w;
+    int y1 = vp.clip_y + vp.clip_h < parent.clip_y + parent.clip_h ? vp.clip_y + vp.clip_h : parent.clip_y + parent.clip_h;
+
+    vp.clip_x = x0;
+    vp.clip_y = y0;
+    vp.clip_w = x1 > x0 ? x1 - x0 : 0;
+    vp.clip_h = y1 > y0 ? y1 - y0 : 0;
+    return vp;
+}
+TR_API void tr_ctx_set_viewport(TrRenderContext *ctx, TrViewport viewport) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_VIEWPORT);
+        tr_priv_rec_int(ctx->recorder, viewport.x);
+        tr_priv_rec_int(ctx->recorder, viewport.y);
+        tr_priv_rec_int(ctx->recorder, viewport.clip_x);
+        tr_priv_rec_int(ctx->recorder, viewport.clip_y);
+        tr_priv_rec_int(ctx->recorder, viewport.clip_w);
+        tr_priv_rec_int(ctx->recorder, viewport.clip_h);
+    }
+
+    TrViewport clip = tr_viewport_sub(tr_viewport(0, 0, ctx->width, ctx->height), viewport.clip_x, viewport.clip_y, viewport.clip_w, viewport.clip_h); // Cut to the context.
+
+    ctx->viewport = viewport;
+    ctx->viewport.clip_x = clip.clip_x;
+    ctx->viewport.clip_y = clip.clip_y;
+    ctx->viewport.clip_w = clip.clip_w;
+    ctx->viewport.clip_h = clip.clip_h;
+}
+TR_API void tr_ctx_reset_viewport(TrRenderContext *ctx) {
+    tr_ctx_set_viewport(ctx, tr_viewport(0, 0, ctx->width, ctx->height));
+}
+TR_API TrResult tr_ctx_intern_grapheme(TrRenderContext *ctx, const char *text, size_t len, char *letter) {
+    if (!text || !letter || len == 0 || len > TR_MAX_GRAPHEME_LEN || (uint8_t)text[0] == TR_PRIV_GRAPHEME || memchr(text, '\0', len) != NULL)
+        return TR_ERR_BAD_ARG;
+
+    memset(letter, 0, TR_MAX_UTF8_LEN);
+    if (len <= TR_MAX_UTF8_LEN) {
+        memcpy(letter, text, len);
         return TR_OK;
+    }
+
+    if (ctx->graphemes == NULL) {
+        ctx->graphemes = TR_MALLOC(sizeof(TrGraphemePool));
+        if (ctx->graphemes == NULL)
+            return TR_ERR_ALLOC_FAIL;
+        tr_priv_grapheme_reset(ctx->graphemes);
+    }
 
-    // Draw only dirty rectangle.
-    TR_CHK(tr_draw_spritesheet(tr_ftos(&ctx->back, ctx->width, ctx->height), dirty_rect_x, dirty_rect_y, dirty_rect_w, dirty_rect_h, ctx->x + dirty_rect_x, ctx->y + dirty_rect_y));
+    int id = tr_priv_grapheme_intern(ctx->graphemes, text, len);
+    if (id < 0)
+        return TR_ERR_BUF_OVERFLOW;
 
-    // Update `front` with `back`.
-    tr_priv_ctx_swap(ctx);
+    letter[0] = (char)TR_PRIV_GRAPHEME; // Ids stay below 0xFFFF, so they never look like an invalid cell of `ctx.front`.
+    letter[1] = (char)(id & 0xFF);
+    letter[2] = (char)(id >> 8);
 
     return TR_OK;
 }
-TR_API TrResult tr_ctx_draw_rect(TrRenderContext *ctx, int x, int y, int width, int height, uint32_t color) {
-    if (width <= 0 || height <= 0 || !tr_valid_color(color))
-        return TR_ERR_BAD_ARG;
+TR_API void tr_ctx_reset_graphemes(TrRenderContext *ctx) {
+    if (ctx->recorder != NULL)
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_RESET_GRAPHEMES);
 
-    if (color == TR_TRANSPARENT)
+    TR_FREE(ctx->graphemes);
+    ctx->graphemes = NULL;
+    tr_priv_ctx_invalidate(ctx, 0, 0, ctx->width, ctx->height); // Ids on the screen may mean other clusters from now on.
+}
+TR_API void tr_ctx_set_headless(TrRenderContext *ctx, bool enabled) {
+    ctx->headless = enabled;
+}
+TR_API void tr_ctx_set_tolerance(TrRenderContext *ctx, int tolerance) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_TOLERANCE);
+        tr_priv_rec_int(ctx->recorder, tolerance);
+    }
+
+    ctx->tolerance = tolerance > 0 ? tolerance : 0;
+}
+TR_API void tr_ctx_forget_terminal(TrRenderContext *ctx) {
+    if (ctx->recorder != NULL)
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_FORGET_TERMINAL);
+
+    tr_priv_ctx_forget_terminal(ctx);
+}
+TR_API void tr_ctx_reset_terminal(TrRenderContext *ctx) {
+#ifndef TR_NO_THREADS
+    if (ctx->pipeline != NULL) // Submitted frames go first.
+        tr_pipe_flush(ctx->pipeline);
+    if (ctx->writer != NULL)
+        tr_aw_flush(ctx->writer);
+#endif
+    tr_reset_all();
+    fflush(stdout);
+    tr_ctx_forget_terminal(ctx);
+}
+TR_API void tr_ctx_set_encoder(TrRenderContext *ctx, TrEncoder encoder) {
+    if (ctx->recorder != NULL)
+        tr_priv_rec_encoder(ctx->recorder, encoder);
+
+    ctx->encoder = encoder;
+    if (ctx->style_table) // Cached color codes were written by the old encoder.
+        tr_priv_ctx_rebuild_styles(ctx);
+}
+TR_API void tr_ctx_set_caps(TrRenderContext *ctx, uint32_t caps) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_CAPS);
+        tr_priv_rec_uint(ctx->recorder, caps);
+    }
+
+    ctx->encoder.caps = caps; // Cached color codes do not depend on caps.
+}
+TR_API TrResult tr_ctx_set_style_table(TrRenderContext *ctx, bool enabled) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_STYLE_TABLE);
+        tr_priv_rec_uint(ctx->recorder, enabled);
+    }
+
+    if (enabled == ctx->style_table)
         return TR_OK;
 
-    int visible_cols = 0;
-    int _0 = 0; // placeholder
-    tr_priv_get_visible(&visible_cols, &_0, ctx->width, width, x);
-    if (visible_cols <= 0)
+    if (!enabled) {
+        TR_FREE(ctx->styles); // The ids live in the same block.
+        ctx->styles = NULL;
+        ctx->front.style = NULL;
+        ctx->back.style = NULL;
+        ctx->style_table = false;
         return TR_OK;
+    }
 
-    int visible_rows = 0;
-    int _1 = 0; // placeholder
-    tr_priv_get_visible(&visible_rows, &_1, ctx->width, height, y);
-    if (visible_rows <= 0)
+    TrPrivStyleBlock *block = TR_MALLOC(sizeof(TrPrivStyleBlock));
+    if (block == NULL)
+        return TR_ERR_ALLOC_FAIL;
+
+    ctx->styles = &block->table;
+    ctx->front.style = block->front;
+    ctx->back.style = block->back;
+    ctx->style_table = true;
+    tr_priv_ctx_rebuild_styles(ctx);
+
+    return TR_OK;
+}
+TR_API void tr_ctx_set_lazy_clear(TrRenderContext *ctx, bool enabled) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_LAZY_CLEAR);
+        tr_priv_rec_uint(ctx->recorder, enabled);
+    }
+
+    if (enabled == ctx->lazy_clear)
+        return;
+
+    if (enabled) { // Every cell of `back` is up to date now.
+        memset(ctx->gen, 0, sizeof(ctx->gen));
+        ctx->clear_gen = 0;
+    } else {
+        tr_priv_ctx_resolve(ctx, 0, ctx->width * ctx->height);
+    }
+    ctx->lazy_clear = enabled;
+}
+static TrResult tr_priv_ctx_render(TrRenderContext *ctx, TrFramebufferBase *back_fb, bool style_drawn) { // Renders `back_fb`, which is `ctx.back` or a frame of a pipeline. With `style_drawn`, only cells that are drawn get style ids, from the table of `ctx`.
+    size_t cell_cost = tr_priv_ctx_cell_cost(ctx);
+
+    ctx->stats.bytes = 0;
+    ctx->stats.coalesced = false;
+
+    char sync_buf[TR_MAX_RAW_BUFFER_LEN];
+    int slot = -1;
+    char *raw_buf = tr_priv_ctx_acquire_output(ctx, sync_buf, &slot);
+    if (raw_buf == NULL) { // The queued frame is of another context. `front` stays untouched, so the next render also sends the damage of this frame.
+        ctx->stats.coalesced = true;
+        ctx->stats.coalesced_count += 1;
         return TR_OK;
+    }
 
-    int fb_base = (x > 0 ? x : 0) + (y > 0 ? y : 0) * ctx->width; // [fb_base] == [y or 0][x or 0]
+    // Find the dirty spans of each row once. They are drawn and copied to `front` from the list.
+    uint32_t dirty = 0, spans = 0;
+    int damage_x0 = ctx->width, damage_x1 = 0, damage_y0 = ctx->height, damage_y1 = 0; // Bounds of the spans.
+    for (int row = 0; row < ctx->height; row += 1) {
+        int fb_row_base = row * ctx->width; // [fb_row_base] == [row][0]
+        if (tr_priv_ctx_memcmp(ctx, back_fb, fb_row_base, (size_t)ctx->width) == -2)
+            continue;
 
-    for (int row = 0; row < visible_rows; row += 1) {
-        int fb_row_base = fb_base + row * ctx->width; // [fb_row_base] == [y + row][x]
+        int col = 0, start = 0, end = 0;
+        while (tr_priv_ctx_next_span(ctx, back_fb, fb_row_base, &col, &start, &end)) {
+            ctx->span_list[spans * 2] = (uint32_t)(fb_row_base + start);
+            ctx->span_list[spans * 2 + 1] = (uint32_t)(fb_row_base + end);
+            dirty += (uint32_t)(end - start);
+            spans += 1;
+            damage_x0 = start < damage_x0 ? start : damage_x0;
+            damage_x1 = end > damage_x1 ? end : damage_x1;
+            damage_y0 = row < damage_y0 ? row : damage_y0;
+            damage_y1 = row + 1;
+        }
+    }
 
-        memset(&ctx->back.effects[fb_row_base], TR_DEFAULT_EFFECT, (size_t)visible_cols * sizeof(TrEffect)); // TR_DEFUALT_EFFECT == 0, ok to memset.
+    // Draw every cell if most of the screen is changing. It needs no cursor movement inside rows.
+    bool full = tr_priv_ctx_plan_full(ctx, cell_cost, dirty, spans);
+    ctx->stats.cells = 0;
+    ctx->stats.dirty = 0;
+    ctx->stats.spans = 0;
+    ctx->stats.full_redraw = false;
 
-        for (int col = 0; col < visible_cols; col += 1) {
-            int idx = col + fb_row_base; // [idx] == [y + row][x + col]
+    size_t raw_buf_idx = 0;
+    TrResult r = TR_OK;
+    if (!ctx->headless && tr_priv_term_owner != ctx) // Another context or a `tr_XXX` call wrote since, so the kept style is stale.
+        tr_priv_ctx_forget_terminal(ctx);
+    TrTerminalState start_term = ctx->term;
+    TrTerminalState term = ctx->term; // Kept only if the frame is sent.
+    TrCellSpan back = tr_ftos(back_fb, ctx->width, ctx->height);
+    const uint16_t *ids = tr_priv_ctx_has_ids(ctx) ? back_fb->style : NULL;
+    uint32_t cells = 0;
+
+    if (style_drawn) { // Cells that are not drawn keep stale ids, so ids are only used to encode.
+        if (ctx->styles->overflow)
+            tr_priv_style_reset(ctx->styles);
+
+        if (full) {
+            tr_priv_style_cells(ctx->styles, &ctx->encoder, back_fb, 0, ctx->width * ctx->height);
+        } else {
+            for (uint32_t i = 0; i < spans; i += 1) {
+                tr_priv_style_cells(ctx->styles, &ctx->encoder, back_fb, (int)ctx->span_list[i * 2], (int)(ctx->span_list[i * 2 + 1] - ctx->span_list[i * 2]));
+            }
+        }
+        ids = ctx->styles->overflow ? NULL : back_fb->style;
+    }
+
+    // Scroll first. `front` is already scrolled.
+    if (ctx->scroll_n > 0)
+        r = tr_priv_strcat_scroll(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx, &ctx->encoder, &term, ctx->y + ctx->scroll_y, ctx->scroll_h, ctx->scroll_n);
+
+    if (full && r == TR_OK) {
+        size_t scrolled_idx = raw_buf_idx;
+        TrTerminalState scrolled = term;
+
+        r = tr_priv_strcat_spritesheet(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx, &ctx->encoder, &term, back, ctx->styles, ids, ctx->graphemes, 0, 0, ctx->width, ctx->height, ctx->x, ctx->y);
+        cells = (uint32_t)(ctx->width * ctx->height);
+        if (r == TR_ERR_BUF_OVERFLOW) { // Dirty spans may still fit.
+            raw_buf_idx = scrolled_idx;
+            term = scrolled;
+            full = false;
+            cells = 0;
+            r = TR_OK;
+        }
+    }
+
+    // Draw only dirty spans of each row.
+    for (uint32_t i = 0; i < spans && r == TR_OK && !full; i += 1) {
+        int start = (int)ctx->span_list[i * 2] % ctx->width;
+        int row = (int)ctx->span_list[i * 2] / ctx->width;
+        int len = (int)(ctx->span_list[i * 2 + 1] - ctx->span_list[i * 2]);
+
+        r = tr_priv_strcat_spritesheet(raw_buf, TR_MAX_RAW_BUFFER_LEN, &raw_buf_idx, &ctx->encoder, &term, back, ctx->styles, ids, ctx->graphemes, start, row, len, 1, ctx->x + start, ctx->y + row);
+        cells += (uint32_t)len;
+    }
+    if (r != TR_OK || raw_buf_idx == 0) {
+        tr_priv_ctx_release_output(ctx, slot);
+        return r;
+    }
+    if (full) {
+        damage_x0 = damage_y0 = 0;
+        damage_x1 = ctx->width;
+        damage_y1 = ctx->height;
+    }
+    if (ctx->scroll_n > 0) { // Every row of the region moved.
+        damage_x0 = 0;
+        damage_x1 = ctx->width;
+        damage_y0 = ctx->scroll_y < damage_y0 ? ctx->scroll_y : damage_y0;
+        damage_y1 = ctx->scroll_y + ctx->scroll_h > damage_y1 ? ctx->scroll_y + ctx->scroll_h : damage_y1;
+    }
+    int damage[4] = {damage_x0, damage_y0, damage_x1 - damage_x0, damage_y1 - damage_y0};
+    tr_priv_ctx_submit_output(ctx, raw_buf, slot, raw_buf_idx, &start_term, damage);
+    ctx->stats.bytes = raw_buf_idx;
+    ctx->stats.cells = cells;
+    ctx->stats.full_redraw = full;
+    ctx->scroll_n = 0;
+    ctx->term = term;
+
+    // Update `front` with what was drawn.
+    if (full) {
+        tr_priv_ctx_swap(ctx, back_fb, 0, 0, ctx->width, ctx->height);
+    } else {
+        for (uint32_t i = 0; i < spans; i += 1) {
+            int start = (int)ctx->span_list[i * 2];
+            tr_priv_ctx_swap(ctx, back_fb, start % ctx->width, start / ctx->width, (int)ctx->span_list[i * 2 + 1] - start, 1);
+        }
+    }
+    ctx->stats.dirty = dirty;
+    ctx->stats.spans = spans;
+
+    return TR_OK;
+}
+TR_API TrResult tr_ctx_render(TrRenderContext *ctx) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_RENDER);
+        ctx->recorder->frames += 1;
+    }
+
+    tr_priv_ctx_resolve(ctx, 0, ctx->width * ctx->height);
+    if (ctx->style_table && ctx->styles->overflow)
+        tr_priv_ctx_rebuild_styles(ctx);
+
+    return tr_priv_ctx_render(ctx, &ctx->back, false);
+}
+static void tr_priv_restride(void *plane, size_t elem, int old_w, int new_w, int rows) { // Moves rows of a plane from `old_w` to `new_w` cells apart. Only the first min(old_w, new_w) cells of each row are kept.
+    char *p = plane;
+    size_t keep = (size_t)(old_w < new_w ? old_w : new_w) * elem;
+
+    if (new_w < old_w) { // Rows move to lower addresses, so go forward.
+        for (int row = 1; row < rows; row += 1) {
+            memmove(p + (size_t)(row * new_w) * elem, p + (size_t)(row * old_w) * elem, keep);
+        }
+    } else if (new_w > old_w) {
+        for (int row = rows - 1; row > 0; row -= 1) {
+            memmove(p + (size_t)(row * new_w) * elem, p + (size_t)(row * old_w) * elem, keep);
+        }
+    }
+}
+static void tr_priv_fb_restride(TrFramebufferBase *fb, int old_w, int new_w, int rows) {
+    tr_priv_restride(fb->letter, TR_MAX_UTF8_LEN, old_w, new_w, rows);
+    tr_priv_restride(fb->effects, sizeof(TrEffect), old_w, new_w, rows);
+    tr_priv_restride(fb->fg, sizeof(uint32_t), old_w, new_w, rows);
+    tr_priv_restride(fb->bg, sizeof(uint32_t), old_w, new_w, rows);
+    if (fb->style != NULL)
+        tr_priv_restride(fb->style, sizeof(uint16_t), old_w, new_w, rows);
+}
+TR_API TrResult tr_ctx_resize(TrRenderContext *ctx, int width, int height) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_RESIZE);
+        tr_priv_rec_int(ctx->recorder, width);
+        tr_priv_rec_int(ctx->recorder, height);
+    }
+
+    if (width <= 0 || height <= 0 || (width * height > TR_MAX_FRAMEBUFFER_LEN))
+        return TR_ERR_BAD_ARG;
+
+    if (width == ctx->width && height == ctx->height)
+        return TR_OK;
+
+    int rows = ctx->height < height ? ctx->height : height; // Rows and columns that are kept.
+    int cols = ctx->width < width ? ctx->width : width;
+
+    tr_priv_fb_restride(&ctx->front, ctx->width, width, rows);
+    tr_priv_fb_restride(&ctx->back, ctx->width, width, rows);
+    tr_priv_restride(ctx->gen, sizeof(uint32_t), ctx->width, width, rows);
+    ctx->width = width;
+    ctx->height = height;
+    ctx->viewport = tr_viewport(0, 0, width, height); // The old one may be outside now.
+
+    // New cells are blank in `back` and unknown in `front`, so only they are drawn.
+    for (int row = 0; row < height; row += 1) {
+        int from = row < rows ? cols : 0;
+        if (from >= width)
+            continue;
+
+        int fb_idx = from + row * width; // [fb_idx] == [row][from]
+        size_t n = (size_t)(width - from);
+
+        tr_priv_fill_letter(&ctx->back.letter[fb_idx], " ", n);
+        tr_priv_fill_effects(&ctx->back.effects[fb_idx], TR_DEFAULT_EFFECT, n);
+        tr_priv_fill_32(&ctx->back.fg[fb_idx], TR_DEFAULT_COLOR_16, n);
+        tr_priv_fill_32(&ctx->back.bg[fb_idx], TR_DEFAULT_COLOR_16, n);
+        tr_priv_fill_32(&ctx->gen[fb_idx], ctx->clear_gen - 1, n); // Stale, so lazy clear gives them the last clear color.
+        tr_priv_ctx_restyle(ctx, &ctx->back, fb_idx, (int)n);
+
+        tr_priv_fill_letter(&ctx->front.letter[fb_idx], "\xff\xff\xff", n);
+        if (ctx->front.style != NULL)
+            memset(&ctx->front.style[fb_idx], 0xFF, n * sizeof(uint16_t));
+    }
+
+    if (ctx->scroll_n > 0) { // `front` was scrolled for a region that may not exist any more.
+        ctx->scroll_n = 0;
+        tr_priv_ctx_invalidate(ctx, 0, 0, width, height);
+    }
+    tr_priv_ctx_forget_terminal(ctx);
+
+    return TR_OK;
+}
+TR_API void tr_ctx_invalidate(TrRenderContext *ctx, int x, int y, int width, int height) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_INVALIDATE);
+        tr_priv_rec_int(ctx->recorder, x);
+        tr_priv_rec_int(ctx->recorder, y);
+        tr_priv_rec_int(ctx->recorder, width);
+        tr_priv_rec_int(ctx->recorder, height);
+    }
+
+    tr_priv_ctx_invalidate(ctx, x, y, width, height);
+}
+TR_API void tr_ctx_invalidate_all(TrRenderContext *ctx) {
+    tr_ctx_invalidate(ctx, 0, 0, ctx->width, ctx->height);
+}
+TR_API TrResult tr_ctx_scroll(TrRenderContext *ctx, int y, int height, int n) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_SCROLL);
+        tr_priv_rec_int(ctx->recorder, y);
+        tr_priv_rec_int(ctx->recorder, height);
+        tr_priv_rec_int(ctx->recorder, n);
+    }
+
+    if (y < 0 || height <= 0 || y + height > ctx->height || n <= 0 || n > height)
+        return TR_ERR_BAD_ARG;
+
+    if (ctx->scroll_n > 0) { // Only one region can be scrolled in a frame.
+        if (ctx->scroll_y != y || ctx->scroll_h != height || ctx->scroll_n + n > height)
+            return TR_ERR_BAD_ARG;
+    }
+
+    ctx->scroll_y = y;
+    ctx->scroll_h = height;
+    ctx->scroll_n += n;
+#ifndef TR_NO_THREADS
+    if (ctx->pipeline != NULL) { // The pipeline has the screen and scrolls it with the next frame.
+        tr_priv_pipe_scroll(ctx->pipeline->priv, y, height, n);
+        return TR_OK;
+    }
+#endif
+
+    // Scroll `front` the same way the terminal will, so only new rows differ from `back`.
+    int fb_top = y * ctx->width;                 // [fb_top] == [y][0]
+    int fb_new = (y + height - n) * ctx->width;  // [fb_new] == [y + height - n][0]
+    size_t moved = (size_t)((height - n) * ctx->width);
+    size_t cleared = (size_t)(n * ctx->width);
+
+    memmove(&ctx->front.letter[fb_top], &ctx->front.letter[fb_top + n * ctx->width], moved * TR_MAX_UTF8_LEN);
+    memmove(&ctx->front.effects[fb_top], &ctx->front.effects[fb_top + n * ctx->width], moved * sizeof(TrEffect));
+    memmove(&ctx->front.fg[fb_top], &ctx->front.fg[fb_top + n * ctx->width], moved * sizeof(uint32_t));
+    memmove(&ctx->front.bg[fb_top], &ctx->front.bg[fb_top + n * ctx->width], moved * sizeof(uint32_t));
+    if (ctx->front.style != NULL)
+        memmove(&ctx->front.style[fb_top], &ctx->front.style[fb_top + n * ctx->width], moved * sizeof(uint16_t));
+
+    tr_priv_fill_letter(&ctx->front.letter[fb_new], " ", cleared);
+    tr_priv_fill_effects(&ctx->front.effects[fb_new], TR_DEFAULT_EFFECT, cleared);
+    tr_priv_fill_32(&ctx->front.fg[fb_new], TR_DEFAULT_COLOR_16, cleared);
+    tr_priv_fill_32(&ctx->front.bg[fb_new], TR_DEFAULT_COLOR_16, cleared);
+    tr_priv_ctx_restyle(ctx, &ctx->front, fb_new, (int)cleared);
+
+    return TR_OK;
+}
+TR_API TrResult tr_ctx_draw_rect(TrRenderContext *ctx, int x, int y, int width, int height, uint32_t color) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_RECT);
+        tr_priv_rec_int(ctx->recorder, x);
+        tr_priv_rec_int(ctx->recorder, y);
+        tr_priv_rec_int(ctx->recorder, width);
+        tr_priv_rec_int(ctx->recorder, height);
+        tr_priv_rec_uint(ctx->recorder, color);
+    }
+
+    if (width <= 0 || height <= 0 || !tr_valid_color(color))
+        return TR_ERR_BAD_ARG;
+
+    if (color == TR_TRANSPARENT)
+        return TR_OK;
+
+    tr_priv_ctx_to_clip(ctx, &x, &y);
+    int visible_cols = 0;
+    int _0 = 0; // placeholder
+    tr_priv_get_visible(&visible_cols, &_0, ctx->viewport.clip_w, width, x);
+    if (visible_cols <= 0)
+        return TR_OK;
+
+    int visible_rows = 0;
+    int _1 = 0; // placeholder
+    tr_priv_get_visible(&visible_rows, &_1, ctx->viewport.clip_h, height, y);
+    if (visible_rows <= 0)
+        return TR_OK;
+
+    int fb_base = tr_priv_ctx_base(ctx, x, y); // [fb_base] == [y or 0][x or 0]
+
+    for (int row = 0; row < visible_rows; row += 1) {
+        int fb_row_base = fb_base + row * ctx->width; // [fb_row_base] == [y + row][x]
+
+        tr_priv_ctx_touch(ctx, fb_row_base, visible_cols);
+        tr_priv_fill_letter(&ctx->back.letter[fb_row_base], " ", (size_t)visible_cols);
+        tr_priv_fill_effects(&ctx->back.effects[fb_row_base], TR_DEFAULT_EFFECT, (size_t)visible_cols);
+        tr_priv_fill_32(&ctx->back.fg[fb_row_base], color, (size_t)visible_cols);
+        tr_priv_fill_32(&ctx->back.bg[fb_row_base], color, (size_t)visible_cols);
+        tr_priv_ctx_restyle(ctx, &ctx->back, fb_row_base, visible_cols);
+    }
+
+    return TR_OK;
+}
+TR_API TrResult tr_ctx_draw_sprite(TrRenderContext *ctx, TrCellSpan sprite, int x, int y) {
+    if (ctx->recorder != NULL)
+        tr_priv_rec_sprite(ctx->recorder, TR_PRIV_REC_SPRITE, ctx->graphemes, sprite, x, y);
+
+    if (sprite.width <= 0 || sprite.height <= 0)
+        return TR_ERR_BAD_ARG;
+
+    tr_priv_ctx_to_clip(ctx, &x, &y);
+    int visible_cols = 0;
+    int spr_col = 0;
+    tr_priv_get_visible(&visible_cols, &spr_col, ctx->viewport.clip_w, sprite.width, x);
+    if (visible_cols <= 0)
+        return TR_OK;
+
+    int visible_rows = 0;
+    int spr_row = 0;
+    tr_priv_get_visible(&visible_rows, &spr_row, ctx->viewport.clip_h, sprite.height, y);
+    if (visible_rows <= 0)
+        return TR_OK;
+
+    int fb_base = tr_priv_ctx_base(ctx, x, y); // [fb_base] == [y or 0][x or 0]
+    int spr_base = spr_col + spr_row * sprite.width;              // [spr_base] == [spr_row][spr_col]
+
+    for (int row = 0; row < visible_rows; row += 1) {
+        int fb_row_base = fb_base + row * ctx->width;     // [fb_row_base] == [y + row][x]
+        int spr_row_base = spr_base + row * sprite.width; // [spr_row_base] == [spr_row + row][spr_col]
+
+        tr_priv_ctx_resolve(ctx, fb_row_base, visible_cols); // Transparent cells keep the colors below.
+        memcpy(&ctx->back.letter[fb_row_base], &sprite.letter[spr_row_base], (size_t)visible_cols * TR_MAX_UTF8_LEN);
+        memcpy(&ctx->back.effects[fb_row_base], &sprite.effects[spr_row_base], (size_t)visible_cols * sizeof(TrEffect));
+
+        for (int col = 0; col < visible_cols; col += 1) {
+            int spr_idx = col + spr_row_base; // [spr_idx] == [spr_row + row][spr_col + col]
+
+            if (sprite.fg[spr_idx] != TR_TRANSPARENT) {
+                int fb_idx = col + fb_row_base; // [fb_idx] == [y + row][x + col]
+
+                ctx->back.fg[fb_idx] = sprite.fg[spr_idx];
+            }
+            if (sprite.bg[spr_idx] != TR_TRANSPARENT) {
+                int fb_idx = col + fb_row_base; // [fb_idx] == [y + row][x + col]
+
+                ctx->back.bg[fb_idx] = sprite.bg[spr_idx];
+            }
+        }
+        tr_priv_ctx_restyle(ctx, &ctx->back, fb_row_base, visible_cols);
+    }
+
+    return TR_OK;
+}
+TR_API TrResult tr_ctx_draw_sprite_batch(TrRenderContext *ctx, const TrSpriteInstance *instances, size_t count) {
+    TrResult result = TR_OK;
+
+    if (ctx->recorder != NULL) { // Recorded as single sprites. Replaying them gives the same result.
+        for (size_t i = 0; i < count; i += 1) {
+            tr_priv_rec_sprite(ctx->recorder, TR_PRIV_REC_SPRITE, ctx->graphemes, instances[i].sprite, instances[i].x, instances[i].y);
+        }
+    }
+
+    for (size_t i = 0; i < count; i += 1) {
+        const TrCellSpan *sprite = &instances[i].sprite;
+        if (sprite->width <= 0 || sprite->height <= 0) { // Like `tr_ctx_draw_sprite`, the others are still drawn.
+            result = TR_ERR_BAD_ARG;
+            continue;
+        }
+
+        int x = instances[i].x;
+        int y = instances[i].y;
+        tr_priv_ctx_to_clip(ctx, &x, &y);
+
+        // Culls instances that are off the screen before any per-row work.
+        int x0 = x > 0 ? x : 0;
+        int y0 = y > 0 ? y : 0;
+        int x1 = x + sprite->width < ctx->viewport.clip_w ? x + sprite->width : ctx->viewport.clip_w;
+        int y1 = y + sprite->height < ctx->viewport.clip_h ? y + sprite->height : ctx->viewport.clip_h;
+        if (x0 >= x1 || y0 >= y1)
+            continue;
+
+        int cols = x1 - x0;
+        for (int row = y0; row < y1; row += 1) {
+            int fb_row_base = tr_priv_ctx_base(ctx, x0, row);        // [fb_row_base] == [row][x0] of the clip rectangle
+            int spr_row_base = (x0 - x) + (row - y) * sprite->width; // [spr_row_base] == [row - y][x0 - x]
+
+            tr_priv_ctx_resolve(ctx, fb_row_base, cols); // Transparent cells keep the colors below.
+
+            // Rows of particles are a few cells long, so cells are copied one by one instead of calling memcpy per plane.
+            for (int col = 0; col < cols; col += 1) {
+                int fb_idx = col + fb_row_base;   // [fb_idx] == [row][x0 + col]
+                int spr_idx = col + spr_row_base; // [spr_idx] == [row - y][x0 - x + col]
+
+                memcpy(ctx->back.letter[fb_idx], sprite->letter[spr_idx], TR_MAX_UTF8_LEN);
+                ctx->back.effects[fb_idx] = sprite->effects[spr_idx];
+                if (sprite->fg[spr_idx] != TR_TRANSPARENT)
+                    ctx->back.fg[fb_idx] = sprite->fg[spr_idx];
+                if (sprite->bg[spr_idx] != TR_TRANSPARENT)
+                    ctx->back.bg[fb_idx] = sprite->bg[spr_idx];
+            }
+            tr_priv_ctx_restyle(ctx, &ctx->back, fb_row_base, cols);
+        }
+    }
+
+    return result;
+}
+TR_API TrResult tr_ctx_draw_sprite_transformed(TrRenderContext *ctx, TrCellSpan sprite, int x, int y, TrTransform transform) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_sprite(ctx->recorder, TR_PRIV_REC_SPRITE_TRANSFORMED, ctx->graphemes, sprite, x, y);
+        tr_priv_rec_uint(ctx->recorder, (uint32_t)transform.flip_h | (uint32_t)transform.flip_v << 1);
+        tr_priv_rec_int(ctx->recorder, transform.rotation);
+        tr_priv_rec_int(ctx->recorder, transform.scale);
+    }
+
+    if (sprite.width <= 0 || sprite.height <= 0 || transform.scale < 0)
+        return TR_ERR_BAD_ARG;
+
+    int scale = transform.scale > 0 ? transform.scale : 1;
+    int w = sprite.width;
+    int h = sprite.height;
+
+    // Maps an unscaled destination cell (u_row, u_col) back to the source cell (row, col):
+    // row = row_0 + u_row * row_r + u_col * row_c, col = col_0 + u_row * col_r + u_col * col_c
+    int row_0, row_r, row_c, col_0, col_r, col_c;
+    int dst_w, dst_h;
+    switch (transform.rotation) {
+    case 0:
+        row_0 = 0, row_r = 1, row_c = 0;
+        col_0 = 0, col_r = 0, col_c = 1;
+        dst_w = w, dst_h = h;
+        break;
+    case 90:
+        row_0 = h - 1, row_r = 0, row_c = -1;
+        col_0 = 0, col_r = 1, col_c = 0;
+        dst_w = h, dst_h = w;
+        break;
+    case 180:
+        row_0 = h - 1, row_r = -1, row_c = 0;
+        col_0 = w - 1, col_r = 0, col_c = -1;
+        dst_w = w, dst_h = h;
+        break;
+    case 270:
+        row_0 = 0, row_r = 0, row_c = 1;
+        col_0 = w - 1, col_r = -1, col_c = 0;
+        dst_w = h, dst_h = w;
+        break;
+    default:
+        return TR_ERR_BAD_ARG;
+    }
+    if (transform.flip_v) {
+        row_0 = h - 1 - row_0, row_r = -row_r, row_c = -row_c;
+    }
+    if (transform.flip_h) {
+        col_0 = w - 1 - col_0, col_r = -col_r, col_c = -col_c;
+    }
+
+    int spr_origin = col_0 + row_0 * w; // [spr_origin] == source of the top-left destination cell.
+    int spr_row_step = col_r + row_r * w;
+    int spr_col_step = col_c + row_c * w;
+
+    tr_priv_ctx_to_clip(ctx, &x, &y);
+    int visible_cols = 0;
+    int dst_col = 0;
+    tr_priv_get_visible(&visible_cols, &dst_col, ctx->viewport.clip_w, dst_w * scale, x);
+    if (visible_cols <= 0)
+        return TR_OK;
+
+    int visible_rows = 0;
+    int dst_row = 0;
+    tr_priv_get_visible(&visible_rows, &dst_row, ctx->viewport.clip_h, dst_h * scale, y);
+    if (visible_rows <= 0)
+        return TR_OK;
+
+    int fb_base = tr_priv_ctx_base(ctx, x, y); // [fb_base] == [y or 0][x or 0]
+
+    for (int row = 0; row < visible_rows; row += 1) {
+        int fb_row_base = fb_base + row * ctx->width;                             // [fb_row_base] == [y + row][x]
+        int spr_row_base = spr_origin + ((dst_row + row) / scale) * spr_row_step; // Source of [y + row][x] before adding columns.
+
+        tr_priv_ctx_resolve(ctx, fb_row_base, visible_cols); // Transparent cells keep the colors below.
+
+        for (int col = 0; col < visible_cols; col += 1) {
+            int fb_idx = col + fb_row_base;                                      // [fb_idx] == [y + row][x + col]
+            int spr_idx = spr_row_base + ((dst_col + col) / scale) * spr_col_step; // Source of [y + row][x + col]
+
+            memcpy(ctx->back.letter[fb_idx], sprite.letter[spr_idx], TR_MAX_UTF8_LEN);
+            ctx->back.effects[fb_idx] = sprite.effects[spr_idx];
+            if (sprite.fg[spr_idx] != TR_TRANSPARENT)
+                ctx->back.fg[fb_idx] = sprite.fg[spr_idx];
+            if (sprite.bg[spr_idx] != TR_TRANSPARENT)
+                ctx->back.bg[fb_idx] = sprite.bg[spr_idx];
+        }
+        tr_priv_ctx_restyle(ctx, &ctx->back, fb_row_base, visible_cols);
+    }
+
+    return TR_OK;
+}
+TR_API TrResult tr_ctx_draw_sprite_blended(TrRenderContext *ctx, TrCellSpan sprite, int x, int y, uint8_t opacity) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_sprite(ctx->recorder, TR_PRIV_REC_SPRITE_BLENDED, ctx->graphemes, sprite, x, y);
+        tr_priv_rec_uint(ctx->recorder, opacity);
+    }
+
+    if (sprite.width <= 0 || sprite.height <= 0)
+        return TR_ERR_BAD_ARG;
+
+    if (opacity == 0)
+        return TR_OK;
+
+    tr_priv_ctx_to_clip(ctx, &x, &y);
+    int visible_cols = 0;
+    int spr_col = 0;
+    tr_priv_get_visible(&visible_cols, &spr_col, ctx->viewport.clip_w, sprite.width, x);
+    if (visible_cols <= 0)
+        return TR_OK;
+
+    int visible_rows = 0;
+    int spr_row = 0;
+    tr_priv_get_visible(&visible_rows, &spr_row, ctx->viewport.clip_h, sprite.height, y);
+    if (visible_rows <= 0)
+        return TR_OK;
+
+    int fb_base = tr_priv_ctx_base(ctx, x, y); // [fb_base] == [y or 0][x or 0]
+    int spr_base = spr_col + spr_row * sprite.width;              // [spr_base] == [spr_row][spr_col]
+
+    for (int row = 0; row < visible_rows; row += 1) {
+        int fb_row_base = fb_base + row * ctx->width;     // [fb_row_base] == [y + row][x]
+        int spr_row_base = spr_base + row * sprite.width; // [spr_row_base] == [spr_row + row][spr_col]
+        size_t n = (size_t)visible_cols;
+
+        tr_priv_ctx_resolve(ctx, fb_row_base, visible_cols);
+        memcpy(&ctx->back.letter[fb_row_base], &sprite.letter[spr_row_base], n * TR_MAX_UTF8_LEN);
+        memcpy(&ctx->back.effects[fb_row_base], &sprite.effects[spr_row_base], n * sizeof(TrEffect));
+
+        // fg fades into the bg below, so it goes first.
+        tr_priv_blend_row(&ctx->back.fg[fb_row_base], &ctx->back.bg[fb_row_base], &sprite.fg[spr_row_base], n, opacity);
+        tr_priv_blend_row(&ctx->back.bg[fb_row_base], &ctx->back.bg[fb_row_base], &sprite.bg[spr_row_base], n, opacity);
+        tr_priv_ctx_restyle(ctx, &ctx->back, fb_row_base, visible_cols);
+    }
+
+    return TR_OK;
+}
+TR_API TrResult tr_ctx_draw_rect_blended(TrRenderContext *ctx, int x, int y, int width, int height, uint32_t color, uint8_t opacity) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_RECT_BLENDED);
+        tr_priv_rec_int(ctx->recorder, x);
+        tr_priv_rec_int(ctx->recorder, y);
+        tr_priv_rec_int(ctx->recorder, width);
+        tr_priv_rec_int(ctx->recorder, height);
+        tr_priv_rec_uint(ctx->recorder, color);
+        tr_priv_rec_uint(ctx->recorder, opacity);
+    }
+
+    if (width <= 0 || height <= 0 || !tr_valid_color(color))
+        return TR_ERR_BAD_ARG;
+
+    if (color == TR_TRANSPARENT || opacity == 0)
+        return TR_OK;
+
+    tr_priv_ctx_to_clip(ctx, &x, &y);
+    int visible_cols = 0;
+    int _0 = 0; // placeholder
+    tr_priv_get_visible(&visible_cols, &_0, ctx->viewport.clip_w, width, x);
+    if (visible_cols <= 0)
+        return TR_OK;
+
+    int visible_rows = 0;
+    int _1 = 0; // placeholder
+    tr_priv_get_visible(&visible_rows, &_1, ctx->viewport.clip_h, height, y);
+    if (visible_rows <= 0)
+        return TR_OK;
+
+    int fb_base = tr_priv_ctx_base(ctx, x, y); // [fb_base] == [y or 0][x or 0]
+
+    for (int row = 0; row < visible_rows; row += 1) {
+        int fb_row_base = fb_base + row * ctx->width; // [fb_row_base] == [y + row][x]
+        size_t n = (size_t)visible_cols;
+
+        tr_priv_ctx_resolve(ctx, fb_row_base, visible_cols);
+        tr_priv_blend_row_color(&ctx->back.fg[fb_row_base], &ctx->back.fg[fb_row_base], color, n, opacity);
+        tr_priv_blend_row_color(&ctx->back.bg[fb_row_base], &ctx->back.bg[fb_row_base], color, n, opacity);
+        tr_priv_ctx_restyle(ctx, &ctx->back, fb_row_base, visible_cols);
+    }
+
+    return TR_OK;
+}
+TR_API TrResult tr_ctx_draw_image(TrRenderContext *ctx, const uint8_t *pixels, int img_w, int img_h, int channels, int x, int y, int width, int height) {
+    if (!pixels || img_w <= 0 || img_h <= 0 || (channels != 3 && channels != 4) || width <= 0 || height <= 0)
+        return TR_ERR_BAD_ARG;
+
+    if (ctx->recorder != NULL) { // Only valid calls are recorded, since the pixels are needed. Others change nothing.
+        size_t size = (size_t)img_w * (size_t)img_h * (size_t)channels;
+        if ((uint64_t)size > UINT32_MAX)
+            tr_priv_rec_unrecordable(ctx->recorder);
+
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_IMAGE);
+        tr_priv_rec_int(ctx->recorder, img_w);
+        tr_priv_rec_int(ctx->recorder, img_h);
+        tr_priv_rec_int(ctx->recorder, channels);
+        tr_priv_rec_int(ctx->recorder, x);
+        tr_priv_rec_int(ctx->recorder, y);
+        tr_priv_rec_int(ctx->recorder, width);
+        tr_priv_rec_int(ctx->recorder, height);
+        tr_priv_rec_bytes(ctx->recorder, pixels, size);
+    }
+
+    tr_priv_ctx_to_clip(ctx, &x, &y);
+    int visible_cols = 0;
+    int img_col = 0;
+    tr_priv_get_visible(&visible_cols, &img_col, ctx->viewport.clip_w, width, x);
+    if (visible_cols <= 0)
+        return TR_OK;
+
+    int visible_rows = 0;
+    int img_row = 0;
+    tr_priv_get_visible(&visible_rows, &img_row, ctx->viewport.clip_h, height, y);
+    if (visible_rows <= 0)
+        return TR_OK;
+
+    int fb_base = tr_priv_ctx_base(ctx, x, y); // [fb_base] == [y or 0][x or 0]
+    int out_h = height * 2;                                       // Output pixels are `width` x `out_h`.
+
+    for (int row = 0; row < visible_rows; row += 1) {
+        int fb_row_base = fb_base + row * ctx->width; // [fb_row_base] == [y + row][x]
+
+        tr_priv_ctx_resolve(ctx, fb_row_base, visible_cols); // Transparent pixels keep the colors below.
+
+        for (int col = 0; col < visible_cols; col += 1) {
+            int fb_idx = col + fb_row_base; // [fb_idx] == [y + row][x + col]
+            int out_x = img_col + col;
+            int x0 = (int)((long long)out_x * img_w / width);
+            int x1 = (int)((long long)(out_x + 1) * img_w / width);
+            if (x1 <= x0)
+                x1 = x0 + 1;
+
+            uint32_t color[2]; // Upper and lower pixel.
+            for (int half = 0; half < 2; half += 1) {
+                int out_y = (img_row + row) * 2 + half;
+                int y0 = (int)((long long)out_y * img_h / out_h);
+                int y1 = (int)((long long)(out_y + 1) * img_h / out_h);
+                if (y1 <= y0)
+                    y1 = y0 + 1;
+
+                uint32_t sum[4];
+                tr_priv_box_sum(sum, pixels, img_w, channels, x0, x1, y0, y1);
+                uint32_t count = (uint32_t)((x1 - x0) * (y1 - y0));
+
+                if (sum[3] / count < 128)
+                    color[half] = TR_TRANSPARENT;
+                else
+                    color[half] = tr_rgb((uint8_t)(sum[0] / count), (uint8_t)(sum[1] / count), (uint8_t)(sum[2] / count));
+            }
+
+            if (color[0] == TR_TRANSPARENT && color[1] == TR_TRANSPARENT)
+                continue;
+
+            if (color[0] == TR_TRANSPARENT) { // Only the lower half is drawn.
+                memcpy(ctx->back.letter[fb_idx], "\xe2\x96\x84", TR_MAX_UTF8_LEN); // U+2584 LOWER HALF BLOCK
+                ctx->back.fg[fb_idx] = color[1];
+            } else {
+                memcpy(ctx->back.letter[fb_idx], "\xe2\x96\x80", TR_MAX_UTF8_LEN); // U+2580 UPPER HALF BLOCK
+                ctx->back.fg[fb_idx] = color[0];
+                if (color[1] != TR_TRANSPARENT)
+                    ctx->back.bg[fb_idx] = color[1];
+            }
+            ctx->back.effects[fb_idx] = TR_DEFAULT_EFFECT;
+        }
+        tr_priv_ctx_restyle(ctx, &ctx->back, fb_row_base, visible_cols);
+    }
+
+    return TR_OK;
+}
+TR_API TrResult tr_ctx_draw_text(TrRenderContext *ctx, const char *text, size_t text_len, TrStyle style, int x, int y) {
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_TEXT);
+        tr_priv_rec_int(ctx->recorder, x);
+        tr_priv_rec_int(ctx->recorder, y);
+        if ((uint64_t)text_len > UINT32_MAX)
+            tr_priv_rec_unrecordable(ctx->recorder);
+
+        tr_priv_rec_style(ctx->recorder, style);
+        tr_priv_rec_uint(ctx->recorder, (uint32_t)text_len);
+        tr_priv_rec_bytes(ctx->recorder, text, text_len);
+    }
+
+    tr_priv_ctx_to_clip(ctx, &x, &y);
+    if (text_len <= 0 || y < 0 || y >= ctx->viewport.clip_h)
+        return TR_ERR_BAD_ARG;
+
+    int visible_cells = 0;
+    int text_codepoint_idx = 0;
+    tr_priv_get_visible(&visible_cells, &text_codepoint_idx, ctx->viewport.clip_w, (int)text_len, x);
+    if (visible_cells <= 0)
+        return TR_OK;
+
+    int fb_base = tr_priv_ctx_base(ctx, x, y); // [fb_base] == [y or 0][x or 0]
+
+    tr_priv_ctx_touch(ctx, fb_base, visible_cells);
+    for (int col = 0; col < visible_cells; col += 1) {
+        int fb_idx = col + fb_base; // [fb_idx] == [y][x + col]
+
+        if (text[col] == '\0')
+            ctx->back.letter[fb_idx][0] = ' ';
+        else
+            ctx->back.letter[fb_idx][0] = text[col];
+
+        ctx->back.letter[fb_idx][1] = '\0';
+
+        ctx->back.effects[fb_idx] = style.effects;
+        ctx->back.fg[fb_idx] = style.fg;
+        ctx->back.bg[fb_idx] = style.bg;
+    }
+    tr_priv_ctx_restyle(ctx, &ctx->back, fb_base, visible_cells);
+
+    return TR_OK;
+}
+static void tr_priv_ctx_draw_hline(TrRenderContext *ctx, int x, int y, int len, const char *cell, TrStyle style) { // `tr_ctx_draw_hline` with a letter already copied into a cell.
+    if (ctx->recorder != NULL) { // Only valid calls are recorded, since the letter is needed. Others change nothing.
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_HLINE);
+        tr_priv_rec_int(ctx->recorder, x);
+        tr_priv_rec_int(ctx->recorder, y);
+        tr_priv_rec_int(ctx->recorder, len);
+        tr_priv_rec_letter(ctx->recorder, ctx->graphemes, cell);
+        tr_priv_rec_style(ctx->recorder, style);
+    }
+
+    tr_priv_ctx_to_clip(ctx, &x, &y);
+    if (y < 0 || y >= ctx->viewport.clip_h)
+        return;
+
+    int visible_cells = 0;
+    int _0 = 0; // placeholder
+    tr_priv_get_visible(&visible_cells, &_0, ctx->viewport.clip_w, len, x);
+    if (visible_cells <= 0)
+        return;
+
+    int fb_base = tr_priv_ctx_base(ctx, x, y); // [fb_base] == [y][x or 0]
+    size_t n = (size_t)visible_cells;
+
+    if (style.fg == TR_TRANSPARENT || style.bg == TR_TRANSPARENT)
+        tr_priv_ctx_resolve(ctx, fb_base, visible_cells);
+    else
+        tr_priv_ctx_touch(ctx, fb_base, visible_cells);
+
+    tr_priv_fill_cell(&ctx->back.letter[fb_base], cell, n);
+    tr_priv_fill_effects(&ctx->back.effects[fb_base], style.effects, n);
+    if (style.fg != TR_TRANSPARENT)
+        tr_priv_fill_32(&ctx->back.fg[fb_base], style.fg, n);
+    if (style.bg != TR_TRANSPARENT)
+        tr_priv_fill_32(&ctx->back.bg[fb_base], style.bg, n);
+    tr_priv_ctx_restyle(ctx, &ctx->back, fb_base, visible_cells);
+}
+static void tr_priv_ctx_draw_vline(TrRenderContext *ctx, int x, int y, int len, const char *cell, TrStyle style) { // `tr_ctx_draw_vline` with a letter already copied into a cell.
+    if (ctx->recorder != NULL) { // Only valid calls are recorded, since the letter is needed. Others change nothing.
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_VLINE);
+        tr_priv_rec_int(ctx->recorder, x);
+        tr_priv_rec_int(ctx->recorder, y);
+        tr_priv_rec_int(ctx->recorder, len);
+        tr_priv_rec_letter(ctx->recorder, ctx->graphemes, cell);
+        tr_priv_rec_style(ctx->recorder, style);
+    }
+
+    tr_priv_ctx_to_clip(ctx, &x, &y);
+    if (x < 0 || x >= ctx->viewport.clip_w)
+        return;
+
+    int visible_cells = 0;
+    int _0 = 0; // placeholder
+    tr_priv_get_visible(&visible_cells, &_0, ctx->viewport.clip_h, len, y);
+    if (visible_cells <= 0)
+        return;
+
+    int fb_base = tr_priv_ctx_base(ctx, x, y); // [fb_base] == [y or 0][x]
+
+    for (int row = 0; row < visible_cells; row += 1) {
+        int fb_idx = fb_base + row * ctx->width; // [fb_idx] == [y + row][x]
+
+        if (style.fg == TR_TRANSPARENT || style.bg == TR_TRANSPARENT)
+            tr_priv_ctx_resolve(ctx, fb_idx, 1);
+        else
+            tr_priv_ctx_touch(ctx, fb_idx, 1);
+
+        memcpy(ctx->back.letter[fb_idx], cell, TR_MAX_UTF8_LEN);
+        ctx->back.effects[fb_idx] = style.effects;
+        if (style.fg != TR_TRANSPARENT)
+            ctx->back.fg[fb_idx] = style.fg;
+        if (style.bg != TR_TRANSPARENT)
+            ctx->back.bg[fb_idx] = style.bg;
+        tr_priv_ctx_restyle(ctx, &ctx->back, fb_idx, 1);
+    }
+}
+TR_API TrResult tr_ctx_draw_hline(TrRenderContext *ctx, int x, int y, int len, const char *letter, TrStyle style) {
+    char cell[TR_MAX_UTF8_LEN];
+    if (len <= 0 || !letter || !tr_priv_cell_letter(cell, letter))
+        return TR_ERR_BAD_ARG;
+
+    tr_priv_ctx_draw_hline(ctx, x, y, len, cell, style);
+    return TR_OK;
+}
+TR_API TrResult tr_ctx_draw_vline(TrRenderContext *ctx, int x, int y, int len, const char *letter, TrStyle style) {
+    char cell[TR_MAX_UTF8_LEN];
+    if (len <= 0 || !letter || !tr_priv_cell_letter(cell, letter))
+        return TR_ERR_BAD_ARG;
+
+    tr_priv_ctx_draw_vline(ctx, x, y, len, cell, style);
+    return TR_OK;
+}
+TR_API TrResult tr_ctx_shade(TrRenderContext *ctx, int x, int y, int width, int height, TrShader shader, void *user, int threads) {
+    if (width <= 0 || height <= 0 || !shader)
+        return TR_ERR_BAD_ARG;
+
+    int draw_x = x, draw_y = y; // Coordinates for the shader.
+    tr_priv_ctx_to_clip(ctx, &x, &y);
+    int visible_cols = 0, skipped_cols = 0;
+    tr_priv_get_visible(&visible_cols, &skipped_cols, ctx->viewport.clip_w, width, x);
+    if (visible_cols <= 0)
+        return TR_OK;
+
+    int visible_rows = 0, skipped_rows = 0;
+    tr_priv_get_visible(&visible_rows, &skipped_rows, ctx->viewport.clip_h, height, y);
+    if (visible_rows <= 0)
+        return TR_OK;
+
+    int fb_base = tr_priv_ctx_base(ctx, x, y); // [fb_base] == [y or 0][x or 0]
+
+    for (int row = 0; row < visible_rows; row += 1) { // Shaders read what was drawn before.
+        tr_priv_ctx_resolve(ctx, fb_base + row * ctx->width, visible_cols);
+    }
+
+    TrPrivShadeJob jobs[TR_PRIV_MAX_SHADE_THREADS];
+    int count = threads < 1 ? 1 : threads;
+    count = count < TR_PRIV_MAX_SHADE_THREADS ? count : TR_PRIV_MAX_SHADE_THREADS;
+    count = count < visible_rows ? count : visible_rows;
+    for (int i = 0; i < count; i += 1) {
+        jobs[i] = (TrPrivShadeJob){
+            .ctx = ctx,
+            .shader = shader,
+            .user = user,
+            .x = draw_x + skipped_cols,
+            .y = draw_y + skipped_rows,
+            .width = visible_cols,
+            .fb_base = fb_base,
+            .row_begin = visible_rows * i / count,
+            .row_end = visible_rows * (i + 1) / count,
+        };
+    }
+
+#ifndef TR_NO_THREADS
+    TrPrivThread workers[TR_PRIV_MAX_SHADE_THREADS];
+    bool started[TR_PRIV_MAX_SHADE_THREADS] = {false};
+    for (int i = 1; i < count; i += 1) {
+        started[i] = tr_priv_thread_start(&workers[i], tr_priv_shade_main, &jobs[i]);
+    }
+    tr_priv_shade_rows(&jobs[0]);
+    for (int i = 1; i < count; i += 1) {
+        if (started[i])
+            tr_priv_thread_join(workers[i]);
+        else // Could not start a thread. Do its rows here.
+            tr_priv_shade_rows(&jobs[i]);
+    }
+#else
+    for (int i = 0; i < count; i += 1) {
+        tr_priv_shade_rows(&jobs[i]);
+    }
+#endif
+
+    for (int row = 0; row < visible_rows; row += 1) {
+        tr_priv_ctx_restyle(ctx, &ctx->back, fb_base + row * ctx->width, visible_cols);
+    }
+
+    if (ctx->recorder != NULL) { // `shader` is code, so the shaded cells are recorded as a sprite instead.
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_SPRITE);
+        tr_priv_rec_int(ctx->recorder, draw_x + skipped_cols);
+        tr_priv_rec_int(ctx->recorder, draw_y + skipped_rows);
+        tr_priv_rec_int(ctx->recorder, visible_cols);
+        tr_priv_rec_int(ctx->recorder, visible_rows);
+
+        TrCellSpan back = tr_ftos(&ctx->back, ctx->width, ctx->height);
+        for (int row = 0; row < visible_rows; row += 1) {
+            tr_priv_rec_cells(ctx->recorder, ctx->graphemes, back, fb_base + row * ctx->width, (size_t)visible_cols);
+        }
+    }
+
+    return TR_OK;
+}
+// ----------------------------------------------------------------------------
+
+// Render pipeline
+// ----------------------------------------------------------------------------
+#ifndef TR_NO_THREADS
+static void tr_priv_pipe_collect(TrPrivPipeline *p, TrRenderContext *ctx, TrPrivPipeRequests *req) { // Moves what `ctx` asked for since the last submit into `req`.
+    req->x = ctx->x;
+    req->y = ctx->y;
+    req->width = ctx->width;
+    req->height = ctx->height;
+    req->tolerance = ctx->tolerance;
+    req->headless = ctx->headless;
+    req->style_table = ctx->style_table;
+    req->encoder = ctx->encoder;
+    req->writer = ctx->writer;
+
+    req->scroll_y = ctx->scroll_y;
+    req->scroll_h = ctx->scroll_h;
+    req->scroll_n = ctx->scroll_n;
+    ctx->scroll_n = 0;
+    req->forget = !ctx->term.known;
+    ctx->term.known = true;
+    req->rect_count = p->rect_count;
+    memcpy(req->rects, p->rects, (size_t)p->rect_count * sizeof(p->rects[0]));
+    p->rect_count = 0;
+}
+static void tr_priv_pipe_apply(TrRenderContext *dst, const TrPrivPipeRequests *req) { // Brings the render context of a pipeline up to date with `req`. Only its thread calls it while it runs.
+    if (tr_ctx_resize(dst, req->width, req->height) != TR_OK)
+        return; // `req` has the size of a valid context, so this never happens.
+
+    if (req->scroll_n > 0 && tr_ctx_scroll(dst, req->scroll_y, req->scroll_h, req->scroll_n) != TR_OK) // `dst` still has a scroll of a coalesced frame.
+        tr_ctx_invalidate(dst, 0, req->scroll_y, dst->width, req->scroll_h);
+    for (int i = 0; i < req->rect_count; i += 1) {
+        tr_ctx_invalidate(dst, req->rects[i][0], req->rects[i][1], req->rects[i][2], req->rects[i][3]);
+    }
+    if (req->forget)
+        tr_ctx_forget_terminal(dst);
+
+    dst->x = req->x;
+    dst->y = req->y;
+    dst->tolerance = req->tolerance;
+    dst->headless = req->headless;
+    dst->writer = req->writer;
+    if (dst->encoder.set_fg != req->encoder.set_fg || dst->encoder.set_bg != req->encoder.set_bg || dst->encoder.set_effects != req->encoder.set_effects) // Cached color codes were written by the old encoder.
+        tr_priv_style_reset(dst->styles);
+    dst->encoder = req->encoder;
+}
+static void tr_priv_pipe_copy_graphemes(TrGraphemePool *dst, const TrGraphemePool *src) { // Copies what rendering needs. `src` may be NULL.
+    if (src == NULL) {
+        dst->count = 0;
+        dst->used = 0;
+        return;
+    }
+
+    dst->count = src->count;
+    dst->used = src->used;
+    memcpy(dst->bytes, src->bytes, src->used);
+    memcpy(dst->offset, src->offset, (size_t)src->count * sizeof(uint32_t));
+    memcpy(dst->len, src->len, (size_t)src->count);
+}
+TR_PRIV_THREAD_FUNC(tr_priv_pipe_main, arg) {
+    TrPrivPipeline *p = arg;
+
+    tr_priv_mutex_lock(&p->mutex);
+    for (;;) {
+        while (p->queued == NULL && !p->quit)
+            tr_priv_cond_wait(&p->cond, &p->mutex);
+        if (p->queued == NULL) // `quit` and nothing left.
+            break;
+
+        TrPrivPipeFrame *frame = p->queued;
+        p->rendering = frame;
+        p->queued = NULL;
+        tr_priv_cond_broadcast(&p->cond);
+        tr_priv_mutex_unlock(&p->mutex);
+
+        tr_priv_pipe_apply(&p->ctx, &frame->req);
+        tr_priv_pipe_copy_graphemes(p->ctx.graphemes, &frame->graphemes);
+        TrResult r = tr_priv_ctx_render(&p->ctx, &frame->back, frame->req.style_table);
+
+        tr_priv_mutex_lock(&p->mutex);
+        p->result = r;
+        p->stats = p->ctx.stats;
+        p->rendering = NULL;
+        tr_priv_cond_broadcast(&p->cond);
+    }
+    tr_priv_mutex_unlock(&p->mutex);
+
+    TR_PRIV_THREAD_RETURN;
+}
+static TrResult tr_priv_pipe_submit(TrRenderContext *ctx) {
+    TrPrivPipeline *p = ctx->pipeline->priv;
+
+    if (ctx->recorder != NULL) {
+        tr_priv_rec_type(ctx->recorder, TR_PRIV_REC_RENDER);
+        ctx->recorder->frames += 1;
+    }
+
+    tr_priv_mutex_lock(&p->mutex);
+    while (p->queued != NULL) // Both frames are busy.
+        tr_priv_cond_wait(&p->cond, &p->mutex);
+    TrPrivPipeFrame *frame = p->rendering == &p->frames[0] ? &p->frames[1] : &p->frames[0];
+    TrResult r = p->result;
+    ctx->stats = p->stats;
+    tr_priv_mutex_unlock(&p->mutex);
+
+    // The thread does not touch `frame` until it is queued.
+    size_t len = (size_t)(ctx->width * ctx->height);
+
+    tr_priv_ctx_resolve(ctx, 0, (int)len); // The thread has no generations.
+    memcpy(frame->back.letter, ctx->back.letter, len * TR_MAX_UTF8_LEN);
+    memcpy(frame->back.effects, ctx->back.effects, len * sizeof(TrEffect));
+    memcpy(frame->back.fg, ctx->back.fg, len * sizeof(uint32_t));
+    memcpy(frame->back.bg, ctx->back.bg, len * sizeof(uint32_t));
+    tr_priv_pipe_copy_graphemes(&frame->graphemes, ctx->graphemes);
+    tr_priv_pipe_collect(p, ctx, &frame->req);
+
+    tr_priv_mutex_lock(&p->mutex);
+    p->queued = frame;
+    tr_priv_cond_broadcast(&p->cond);
+    tr_priv_mutex_unlock(&p->mutex);
+
+    return r;
+}
+
+TR_API TrResult tr_pipe_init(TrPipeline *pipe) {
+    TrPrivPipeline *p = TR_MALLOC(sizeof(TrPrivPipeline));
+    pipe->priv = p;
+    if (p == NULL)
+        return TR_ERR_ALLOC_FAIL;
+
+    p->frames[0].back.style = p->frames[0].ids;
+    p->frames[1].back.style = p->frames[1].ids;
+    p->queued = NULL;
+    p->rendering = NULL;
+    p->result = TR_OK;
+    memset(&p->stats, 0, sizeof(p->stats));
+    p->quit = false;
+    p->rect_count = 0;
+    tr_priv_mutex_init(&p->mutex);
+    tr_priv_cond_init(&p->cond);
+
+    if (!tr_priv_thread_start(&p->thread, tr_priv_pipe_main, p)) {
+        tr_priv_cond_destroy(&p->cond);
+        tr_priv_mutex_destroy(&p->mutex);
+        TR_FREE(p);
+        pipe->priv = NULL;
+        return TR_ERR_ALLOC_FAIL;
+    }
+
+    return TR_OK;
+}
+TR_API void tr_pipe_cleanup(TrPipeline *pipe) {
+    TrPrivPipeline *p = pipe->priv;
+    if (p == NULL)
+        return;
+
+    tr_priv_mutex_lock(&p->mutex);
+    p->quit = true;
+    tr_priv_cond_broadcast(&p->cond);
+    tr_priv_mutex_unlock(&p->mutex);
+
+    tr_priv_thread_join(p->thread);
+    tr_priv_cond_destroy(&p->cond);
+    tr_priv_mutex_destroy(&p->mutex);
+    TR_FREE(p);
+    pipe->priv = NULL;
+}
+TR_API void tr_pipe_flush(TrPipeline *pipe) {
+    TrPrivPipeline *p = pipe->priv;
+    if (p == NULL)
+        return;
+
+    tr_priv_mutex_lock(&p->mutex);
+    while (p->queued != NULL || p->rendering != NULL)
+        tr_priv_cond_wait(&p->cond, &p->mutex);
+    tr_priv_mutex_unlock(&p->mutex);
+}
+TR_API void tr_ctx_set_pipeline(TrRenderContext *ctx, TrPipeline *pipe) {
+    if (ctx->pipeline == pipe || (pipe != NULL && pipe->priv == NULL))
+        return;
+
+    if (ctx->pipeline != NULL) { // Take the screen state back from the old pipeline.
+        TrPrivPipeline *p = ctx->pipeline->priv;
+        TrPrivPipeRequests req;
+
+        tr_pipe_flush(ctx->pipeline);
+        tr_priv_pipe_collect(p, ctx, &req);
+        tr_priv_pipe_apply(&p->ctx, &req);
+        uint16_t *ids = ctx->front.style;
+        ctx->front = p->ctx.front;
+        ctx->front.style = ids;
+        ctx->term = p->ctx.term;
+        if (tr_priv_term_owner == &p->ctx)
+            tr_priv_term_written(ctx);
+        ctx->stats = p->stats;
+        ctx->scroll_y = p->ctx.scroll_y;
+        ctx->scroll_h = p->ctx.scroll_h;
+        ctx->scroll_n = p->ctx.scroll_n;
+        if (ctx->style_table) // Ids of `front` are from the table of the pipeline.
+            tr_priv_ctx_rebuild_styles(ctx);
+        ctx->pipeline = NULL;
+    }
+    if (pipe == NULL)
+        return;
+
+    TrPrivPipeline *p = pipe->priv;
+
+    tr_pipe_flush(pipe);
+    p->ctx = *ctx;
+    p->ctx.recorder = NULL;
+    p->ctx.pipeline = NULL;
+    p->ctx.lazy_clear = false;  // Frames are resolved before they are submitted.
+    p->ctx.style_table = false; // Ids are only given to cells that are drawn. See `tr_priv_ctx_render`.
+    p->ctx.styles = &p->styles;
+    p->ctx.graphemes = &p->graphemes;
+    if (tr_priv_term_owner == ctx) // The thread continues from the style `ctx` left.
+        tr_priv_term_written(&p->ctx);
+    tr_priv_pipe_copy_graphemes(&p->graphemes, ctx->graphemes);
+    p->ctx.front.style = NULL;
+    p->ctx.back.style = NULL;
+    tr_priv_style_reset(&p->styles);
+    p->result = TR_OK;
+    p->stats = ctx->stats;
+    p->rect_count = 0;
+
+    // From now on, `ctx` only collects requests for the pipeline.
+    ctx->term.known = true;
+    ctx->scroll_n = 0;
+    ctx->pipeline = pipe;
+}
+#endif // TR_NO_THREADS
+TR_API TrResult tr_ctx_submit(TrRenderContext *ctx) {
+#ifndef TR_NO_THREADS
+    if (ctx->pipeline != NULL)
+        return tr_priv_pipe_submit(ctx);
+#endif
+    return tr_ctx_render(ctx);
+}
+// ----------------------------------------------------------------------------
+// ============================================================================
 
-            strcpy(ctx->back.letter[idx], " ");
-            ctx->back.fg[idx] = color;
-            ctx->back.bg[idx] = color;
-        }
+// Text pane
+// ============================================================================
+TR_API void tr_tpane_init(TrTextPane *pane) {
+    pane->head = 0;
+    pane->count = 0;
+    pane->appended = 0;
+    pane->drawn_count = 0;
+    pane->terminal_scroll = false;
+}
+TR_API void tr_tpane_set_terminal_scroll(TrTextPane *pane, bool enabled) {
+    pane->terminal_scroll = enabled;
+}
+TR_API void tr_tpane_append(TrTextPane *pane, const char *text, size_t len, TrStyle style) {
+    int row;
+    if (pane->count < TR_MAX_TEXT_PANE_ROWS) {
+        row = (pane->head + pane->count) % TR_MAX_TEXT_PANE_ROWS;
+        pane->count += 1;
+    } else { // Overwrite the oldest line.
+        row = pane->head;
+        pane->head = (pane->head + 1) % TR_MAX_TEXT_PANE_ROWS;
     }
 
-    return TR_OK;
+    if (!text)
+        len = 0;
+    if (len > TR_MAX_TEXT_PANE_COLS)
+        len = TR_MAX_TEXT_PANE_COLS;
+
+    if (len > 0)
+        memcpy(pane->text[row], text, len);
+    pane->len[row] = len;
+    pane->style[row] = style;
+    pane->appended += 1;
 }
-TR_API TrResult tr_ctx_draw_sprite(TrRenderContext *ctx, TrCellSpan sprite, int x, int y) {
-    if (sprite.width <= 0 || sprite.height <= 0)
+TR_API TrResult tr_tpane_draw(TrTextPane *pane, TrRenderContext *ctx, int x, int y, int width, int height) {
+    if (width <= 0 || height <= 0)
         return TR_ERR_BAD_ARG;
 
-    int visible_cols = 0;
-    int spr_col = 0;
-    tr_priv_get_visible(&visible_cols, &spr_col, ctx->width, sprite.width, x);
-    if (visible_cols <= 0)
-        return TR_OK;
-
-    int visible_rows = 0;
-    int spr_row = 0;
-    tr_priv_get_visible(&visible_rows, &spr_row, ctx->height, sprite.height, y);
-    if (visible_rows <= 0)
-        return TR_OK;
-
-    int fb_base = (x > 0 ? x : 0) + (y > 0 ? y : 0) * ctx->width; // [fb_base] == [y or 0][x or 0]
-    int spr_base = spr_col + spr_row * sprite.width;              // [spr_base] == [spr_row][spr_col]
+    // Lines that are still visible only moved up by as much as the first visible line moved. Let the terminal move them.
+    // Until the pane is full, new lines go below the old ones and nothing moves.
+    const TrViewport *vp = &ctx->viewport;
+    int ctx_x = vp->x + x, ctx_y = vp->y + y; // `tr_ctx_scroll` takes rows of the context.
+    bool whole_rows = ctx_x == 0 && width == ctx->width && vp->clip_x == 0 && vp->clip_w == ctx->width;
+    if (pane->terminal_scroll && whole_rows && ctx_y >= vp->clip_y && ctx_y + height <= vp->clip_y + vp->clip_h) {
+        int shown_before = pane->drawn_count < height ? pane->drawn_count : height;
+        int shown = pane->count < height ? pane->count : height;
+        int n = pane->appended - (shown - shown_before);
+        if (n > height)
+            n = height;
+        if (n > 0)
+            TR_CHK(tr_ctx_scroll(ctx, ctx_y, height, n));
+    }
+    pane->appended = 0;
+    pane->drawn_count = pane->count;
 
-    for (int row = 0; row < visible_rows; row += 1) {
-        int fb_row_base = fb_base + row * ctx->width;     // [fb_row_base] == [y + row][x]
-        int spr_row_base = spr_base + row * sprite.width; // [spr_row_base] == [spr_row + row][spr_col]
+    int visible = pane->count < height ? pane->count : height;
+    int first = pane->count - visible; // Index of the first visible line from the oldest one.
+    TrStyle blank = tr_default_style();
 
-        memcpy(&ctx->back.letter[fb_row_base], &sprite.letter[spr_row_base], (size_t)visible_cols * TR_MAX_UTF8_LEN);
-        memcpy(&ctx->back.effects[fb_row_base], &sprite.effects[spr_row_base], (size_t)visible_cols * sizeof(TrEffect));
+    for (int i = 0; i < height; i += 1) {
+        int drawn = 0;
 
-        for (int col = 0; col < visible_cols; col += 1) {
-            int spr_idx = col + spr_row_base; // [spr_idx] == [spr_row + row][spr_col + col]
+        if (ctx_y + i < vp->clip_y || ctx_y + i >= vp->clip_y + vp->clip_h) // Scrolled out of the viewport. `tr_ctx_draw_text` rejects such rows.
+            continue;
+        if (i < visible) {
+            int row = (pane->head + first + i) % TR_MAX_TEXT_PANE_ROWS;
 
-            if (sprite.fg[spr_idx] != TR_TRANSPARENT) {
-                int fb_idx = col + fb_row_base; // [fb_idx] == [y + row][x + col]
+            drawn = (int)pane->len[row] < width ? (int)pane->len[row] : width;
+            if (drawn > 0)
+                TR_CHK(tr_ctx_draw_text(ctx, pane->text[row], (size_t)drawn, pane->style[row], x, y + i));
+        }
+        if (drawn < width)
+            TR_CHK(tr_ctx_draw_hline(ctx, x + drawn, y + i, width - drawn, " ", blank));
+    }
 
-                ctx->back.fg[fb_idx] = sprite.fg[spr_idx];
-            }
-            if (sprite.bg[spr_idx] != TR_TRANSPARENT) {
-                int fb_idx = col + fb_row_base; // [fb_idx] == [y + row][x + col]
+    return TR_OK;
+}
+// ============================================================================
 
-                ctx->back.bg[fb_idx] = sprite.bg[spr_idx];
+#ifndef TR_NO_THREADS
+// Command queue
+// ============================================================================
+TR_API void tr_cmdq_init(TrCommandQueue *q) {
+    for (uint32_t i = 0; i < TR_MAX_COMMAND_QUEUE_LEN; i += 1) {
+        q->seq[i] = i;
+    }
+    q->head = 0;
+    q->tail = 0;
+}
+TR_API TrResult tr_cmdq_push(TrCommandQueue *q, const TrCommand *cmd) {
+    uint32_t pos = tr_priv_atomic_load(&q->tail);
+
+    for (;;) {
+        uint32_t slot = pos & (TR_MAX_COMMAND_QUEUE_LEN - 1);
+        int32_t diff = (int32_t)(tr_priv_atomic_load(&q->seq[slot]) - pos);
+
+        if (diff == 0) { // The slot is free. Claim it.
+            if (tr_priv_atomic_cas(&q->tail, &pos, pos + 1)) {
+                q->cmds[slot] = *cmd;
+                tr_priv_atomic_store(&q->seq[slot], pos + 1); // Publishes the command to the consumer.
+                return TR_OK;
             }
+        } else if (diff < 0) { // The consumer has not released the slot yet.
+            return TR_ERR_BUF_OVERFLOW;
+        } else { // Another producer claimed the slot.
+            pos = tr_priv_atomic_load(&q->tail);
         }
     }
-
-    return TR_OK;
 }
-TR_API TrResult tr_ctx_draw_text(TrRenderContext *ctx, const char *text, size_t text_len, TrStyle style, int x, int y) {
-    if (text_len <= 0 || y < 0 || y >= ctx->height)
-        return TR_ERR_BAD_ARG;
+TR_API TrResult tr_cmdq_push_clear(TrCommandQueue *q, uint32_t bg) {
+    TrCommand cmd = {.type = TR_CMD_CLEAR, .color = bg};
 
-    int visible_cells = 0;
-    int text_codepoint_idx = 0;
-    tr_priv_get_visible(&visible_cells, &text_codepoint_idx, ctx->width, (int)text_len, x);
-    if (visible_cells <= 0)
-        return TR_OK;
+    return tr_cmdq_push(q, &cmd);
+}
+TR_API TrResult tr_cmdq_push_rect(TrCommandQueue *q, int x, int y, int width, int height, uint32_t color) {
+    TrCommand cmd = {.type = TR_CMD_RECT, .x = x, .y = y, .width = width, .height = height, .color = color};
 
-    int fb_base = (x > 0 ? x : 0) + (y > 0 ? y : 0) * ctx->width; // [fb_base] == [y or 0][x or 0]
+    return tr_cmdq_push(q, &cmd);
+}
+TR_API TrResult tr_cmdq_push_sprite(TrCommandQueue *q, TrCellSpan sprite, int x, int y) {
+    TrCommand cmd = {.type = TR_CMD_SPRITE, .x = x, .y = y, .sprite = sprite};
 
-    for (int col = 0; col < visible_cells; col += 1) {
-        int fb_idx = col + fb_base; // [fb_idx] == [y][x + col]
+    return tr_cmdq_push(q, &cmd);
+}
+TR_API TrResult tr_cmdq_push_text(TrCommandQueue *q, const char *text, size_t len, TrStyle style, int x, int y) {
+    if (!text || len > TR_MAX_COMMAND_TEXT_LEN)
+        return TR_ERR_BAD_ARG;
 
-        if (text[col] == '\0')
-            ctx->back.letter[fb_idx][0] = ' ';
-        else
-            ctx->back.letter[fb_idx][0] = text[col];
+    TrCommand cmd = {.type = TR_CMD_TEXT, .x = x, .y = y, .style = style, .text_len = len};
+    memcpy(cmd.text, text, len);
 
-        ctx->back.letter[fb_idx][1] = '\0';
+    return tr_cmdq_push(q, &cmd);
+}
+TR_API TrResult tr_cmdq_drain(TrCommandQueue *q, TrRenderContext *ctx) {
+    TrResult result = TR_OK;
+    uint32_t end = tr_priv_atomic_load(&q->tail); // Commands pushed during the drain wait for the next one, so busy producers cannot keep it running.
+
+    for (uint32_t pos = q->head; pos != end; pos += 1) {
+        uint32_t slot = pos & (TR_MAX_COMMAND_QUEUE_LEN - 1);
+
+        if (tr_priv_atomic_load(&q->seq[slot]) != pos + 1) // The producer is still writing.
+            break;
+
+        const TrCommand *cmd = &q->cmds[slot];
+        TrResult r = TR_OK;
+
+        switch (cmd->type) {
+        case TR_CMD_CLEAR:
+            tr_ctx_clear(ctx, cmd->color);
+            break;
+        case TR_CMD_RECT:
+            r = tr_ctx_draw_rect(ctx, cmd->x, cmd->y, cmd->width, cmd->height, cmd->color);
+            break;
+        case TR_CMD_SPRITE:
+            r = tr_ctx_draw_sprite(ctx, cmd->sprite, cmd->x, cmd->y);
+            break;
+        case TR_CMD_TEXT:
+            r = tr_ctx_draw_text(ctx, cmd->text, cmd->text_len, cmd->style, cmd->x, cmd->y);
+            break;
+        }
+        if (result == TR_OK)
+            result = r;
 
-        ctx->back.effects[fb_idx] = style.effects;
-        ctx->back.fg[fb_idx] = style.fg;
-        ctx->back.bg[fb_idx] = style.bg;
+        q->head = pos + 1;
+        tr_priv_atomic_store(&q->seq[slot], pos + TR_MAX_COMMAND_QUEUE_LEN); // Releases the slot to producers.
     }
 
-    return TR_OK;
+    return result;
 }
-// ----------------------------------------------------------------------------
 // ============================================================================
+#endif // TR_NO_THREADS
 
 // Utility functions
 // ============================================================================
@@ -1189,15 +4644,10 @@ TR_API TrCellSpan tr_ftos(TrFramebufferBase *fb, int width, int height) {
 TR_API void tr_fill_buf(TrCellSpan buf, uint32_t bg) {
     size_t len = (size_t)(buf.width * buf.height);
 
-    for (size_t i = 0; i < len; i += 1) {
-        strcpy(buf.letter[i], " ");
-    }
-    memset(buf.effects, TR_DEFAULT_EFFECT, len * sizeof(TrEffect)); // TR_DEFAULT_EFFECT == 0, ok to memset.
-
-    for (size_t i = 0; i < len; i += 1) {
-        buf.fg[i] = TR_DEFAULT_COLOR_16;
-        buf.bg[i] = bg;
-    }
+    tr_priv_fill_letter(buf.letter, " ", len);
+    tr_priv_fill_effects(buf.effects, TR_DEFAULT_EFFECT, len);
+    tr_priv_fill_32(buf.fg, TR_DEFAULT_COLOR_16, len);
+    tr_priv_fill_32(buf.bg, bg, len);
 }
 // ----------------------------------------------------------------------------
 
@@ -1211,19 +4661,818 @@ TR_API void tr_init(bool unicode) {
     if (unicode)
         SetConsoleOutputCP(CP_UTF8);
 }
+TR_API TrResult tr_get_terminal_size(int *width, int *height) {
+    CONSOLE_SCREEN_BUFFER_INFO info;
+    if (!GetConsoleScreenBufferInfo(GetStdHandle(STD_OUTPUT_HANDLE), &info))
+        return TR_ERR_NO_TERMINAL;
+
+    *width = info.srWindow.Right - info.srWindow.Left + 1;
+    *height = info.srWindow.Bottom - info.srWindow.Top + 1;
+
+    return TR_OK;
+}
+static int tr_priv_last_width = -1, tr_priv_last_height = -1; // Global, since there is one terminal.
+
+TR_API bool tr_poll_resize(int *width, int *height) { // There is no signal for it, so the size is compared.
+    int w = 0, h = 0;
+    if (tr_get_terminal_size(&w, &h) != TR_OK)
+        return false;
+
+    bool first = tr_priv_last_width < 0;
+    bool changed = w != tr_priv_last_width || h != tr_priv_last_height;
+    tr_priv_last_width = w;
+    tr_priv_last_height = h;
+    if (first || !changed)
+        return false;
+
+    *width = w;
+    *height = h;
+    return true;
+}
 
 #else
 
 #include <locale.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <unistd.h>
 
 TR_API void tr_init(bool unicode) {
     setvbuf(stdout, NULL, _IONBF, 0); // Makes stdout unbuffered.
     if (unicode)
         setlocale(LC_ALL, "");
 }
+TR_API TrResult tr_get_terminal_size(int *width, int *height) {
+    struct winsize ws;
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) != 0 || ws.ws_col == 0)
+        return TR_ERR_NO_TERMINAL;
+
+    *width = ws.ws_col;
+    *height = ws.ws_row;
+
+    return TR_OK;
+}
+static volatile sig_atomic_t tr_priv_resized = 0; // Global, since signal handlers are.
+static bool tr_priv_resize_watched = false;
+static struct sigaction tr_priv_old_winch; // Installed before `tr_priv_on_winch`, which chains to it.
+
+static void tr_priv_on_winch(int sig, siginfo_t *info, void *uctx) {
+    tr_priv_resized = 1;
+
+    if (tr_priv_old_winch.sa_flags & SA_SIGINFO)
+        tr_priv_old_winch.sa_sigaction(sig, info, uctx);
+    else if (tr_priv_old_winch.sa_handler != SIG_DFL && tr_priv_old_winch.sa_handler != SIG_IGN)
+        tr_priv_old_winch.sa_handler(sig);
+}
+TR_API bool tr_poll_resize(int *width, int *height) {
+    if (!tr_priv_resize_watched) {
+        struct sigaction sa;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_sigaction = tr_priv_on_winch;
+        sigemptyset(&sa.sa_mask);
+        sa.sa_flags = SA_SIGINFO | SA_RESTART;
+        if (sigaction(SIGWINCH, &sa, &tr_priv_old_winch) != 0)
+            return false;
+
+        tr_priv_resize_watched = true;
+        return false;
+    }
+
+    if (!tr_priv_resized)
+        return false;
+    tr_priv_resized = 0; // Signals that came since the last call are handled at once.
+
+    return tr_get_terminal_size(width, height) == TR_OK;
+}
+
+#endif // defined(_WIN32) || defined(_WIN64)
+// ----------------------------------------------------------------------------
+// ============================================================================
+
+// Event loop
+// ============================================================================
+// Key decoding
+// ----------------------------------------------------------------------------
+static int tr_priv_utf8_len(unsigned char lead) { // Length of a UTF-8 sequence from its first byte. 1 for invalid bytes.
+    if (lead >= 0xF0 && lead < 0xF8)
+        return 4;
+    if (lead >= 0xE0)
+        return lead < 0xF0 ? 3 : 1;
+    if (lead >= 0xC0)
+        return 2;
+    return 1;
+}
+static int tr_priv_csi_key(char final, int num) { // Key of `ESC [ num final` or `ESC O final`.
+    switch (final) {
+    case 'A':
+        return TR_KEY_UP;
+    case 'B':
+        return TR_KEY_DOWN;
+    case 'C':
+        return TR_KEY_RIGHT;
+    case 'D':
+        return TR_KEY_LEFT;
+    case 'H':
+        return TR_KEY_HOME;
+    case 'F':
+        return TR_KEY_END;
+    case 'Z':
+        return TR_KEY_BACKTAB;
+    case 'P':
+    case 'Q':
+    case 'R':
+    case 'S':
+        return TR_KEY_F1 + (final - 'P');
+    case '~':
+        break;
+    default:
+        return TR_KEY_NONE;
+    }
+
+    switch (num) {
+    case 1:
+    case 7:
+        return TR_KEY_HOME;
+    case 2:
+        return TR_KEY_INSERT;
+    case 3:
+        return TR_KEY_DELETE;
+    case 4:
+    case 8:
+        return TR_KEY_END;
+    case 5:
+        return TR_KEY_PAGE_UP;
+    case 6:
+        return TR_KEY_PAGE_DOWN;
+    case 11:
+    case 12:
+    case 13:
+    case 14:
+    case 15:
+        return TR_KEY_F1 + (num - 11);
+    case 17:
+    case 18:
+    case 19:
+    case 20:
+    case 21:
+        return TR_KEY_F1 + 5 + (num - 17);
+    case 23:
+    case 24:
+        return TR_KEY_F1 + 10 + (num - 23);
+    default:
+        return TR_KEY_NONE;
+    }
+}
+TR_API size_t tr_decode_key(const char *buf, size_t len, bool final, TrEvent *event) {
+    const unsigned char *b = (const unsigned char *)buf;
+    memset(event, 0, sizeof(*event));
+    event->type = TR_EVENT_KEY;
+    if (len == 0)
+        return 0;
+
+    if (b[0] != 27) { // A character or a control key.
+        size_t n = (size_t)tr_priv_utf8_len(b[0]);
+        if (n > len)
+            return final ? len : 0;
+
+        int key = n == 1 ? b[0] : (b[0] & (0x7F >> n));
+        for (size_t i = 1; i < n; i += 1) {
+            key = (key << 6) | (b[i] & 0x3F);
+        }
+        event->key = key;
+        if (b[0] >= 32 && b[0] != 127)
+            memcpy(event->text, buf, n);
+        return n;
+    }
+
+    if (len == 1) {
+        if (!final)
+            return 0;
+        event->key = TR_KEY_ESC;
+        return 1;
+    }
+
+    if (b[1] == 'O' && len >= 3) { // SS3: ESC O final
+        event->key = tr_priv_csi_key((char)b[2], 0);
+        return 3;
+    }
+    if (b[1] != '[' && b[1] != 'O') { // ALT + key
+        size_t n = tr_decode_key(buf + 1, len - 1, final, event);
+        if (n == 0)
+            return 0;
+        event->mods |= TR_MOD_ALT;
+        return n + 1;
+    }
+    if (b[1] == 'O') {
+        if (!final)
+            return 0;
+        event->key = 'O';
+        event->mods = TR_MOD_ALT;
+        event->text[0] = 'O';
+        return 2;
+    }
+
+    // CSI: ESC [ params final
+    int params[2] = {0, 0};
+    int count = 0;
+    for (size_t i = 2; i < len; i += 1) {
+        if (b[i] >= '0' && b[i] <= '9') {
+            if (count < 2)
+                params[count] = params[count] * 10 + (b[i] - '0');
+        } else if (b[i] == ';') {
+            count += 1;
+        } else if (b[i] >= 0x40 && b[i] <= 0x7E) {
+            event->key = tr_priv_csi_key((char)b[i], params[0]);
+            if (count >= 1 && params[1] > 1) // The modifier is 1 + the bits.
+                event->mods = (uint8_t)((params[1] - 1) & (TR_MOD_SHIFT | TR_MOD_ALT | TR_MOD_CTRL));
+            return i + 1;
+        } else if (b[i] < 0x20 || b[i] > 0x3F) { // Not a CSI sequence. Drop the introducer.
+            return 2;
+        }
+    }
+    return final ? len : 0;
+}
+// ----------------------------------------------------------------------------
+
+// Waiting
+// ----------------------------------------------------------------------------
+#if defined(_WIN32) || defined(_WIN64)
+
+static DWORD tr_priv_saved_input_mode; // Global, since there is one console. `tr_loop_run` restores it before it returns.
+static bool tr_priv_input_mode_saved = false;
+
+static double tr_priv_now(void) {
+    LARGE_INTEGER freq, count;
+    QueryPerformanceFrequency(&freq);
+    QueryPerformanceCounter(&count);
+    return (double)count.QuadPart / (double)freq.QuadPart;
+}
+static void tr_priv_loop_raw(bool enabled) {
+    HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
+    if (enabled) {
+        tr_priv_input_mode_saved = GetConsoleMode(in, &tr_priv_saved_input_mode) != 0;
+        if (tr_priv_input_mode_saved) // Keys come as VT sequences, so they are decoded like on the other platforms.
+            SetConsoleMode(in, (tr_priv_saved_input_mode & ~(DWORD)(ENABLE_LINE_INPUT | ENABLE_ECHO_INPUT)) | ENABLE_WINDOW_INPUT | ENABLE_VIRTUAL_TERMINAL_INPUT);
+    } else if (tr_priv_input_mode_saved) {
+        SetConsoleMode(in, tr_priv_saved_input_mode);
+    }
+}
+static void tr_priv_loop_wait(TrLoop *loop, int timeout_ms) { // Waits for input up to `timeout_ms`(-1 means forever) and reads it to `loop.input`.
+    HANDLE in = GetStdHandle(STD_INPUT_HANDLE);
+    if (WaitForSingleObject(in, timeout_ms < 0 ? INFINITE : (DWORD)timeout_ms) != WAIT_OBJECT_0)
+        return;
+
+    INPUT_RECORD records[16];
+    DWORD count = 0;
+    DWORD room = (DWORD)(sizeof(loop->input) - loop->input_len);
+    if (room > 16)
+        room = 16;
+    if (!ReadConsoleInputA(in, records, room, &count)) {
+        loop->input_closed = true;
+        return;
+    }
+
+    for (DWORD i = 0; i < count; i += 1) { // Resizes wake the wait and are found by `tr_poll_resize`.
+        if (records[i].EventType == KEY_EVENT && records[i].Event.KeyEvent.bKeyDown && records[i].Event.KeyEvent.uChar.AsciiChar != 0)
+            loop->input[loop->input_len++] = records[i].Event.KeyEvent.uChar.AsciiChar;
+    }
+}
+
+#else
+
+#include <poll.h>
+#include <termios.h>
+#include <time.h>
+
+static struct termios tr_priv_saved_termios; // Global, since there is one terminal. `tr_loop_run` restores it before it returns.
+static bool tr_priv_termios_saved = false;
+
+static double tr_priv_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+static void tr_priv_loop_raw(bool enabled) {
+    if (enabled) {
+        tr_priv_termios_saved = tcgetattr(STDIN_FILENO, &tr_priv_saved_termios) == 0;
+        if (!tr_priv_termios_saved) // Not a terminal. Input is read as it is.
+            return;
+
+        struct termios raw = tr_priv_saved_termios;
+        raw.c_lflag &= ~(tcflag_t)(ICANON | ECHO);
+        raw.c_iflag &= ~(tcflag_t)ICRNL; // Enter is 13 like on Windows.
+        raw.c_cc[VMIN] = 1;
+        raw.c_cc[VTIME] = 0;
+        tcsetattr(STDIN_FILENO, TCSANOW, &raw);
+    } else if (tr_priv_termios_saved) {
+        tcsetattr(STDIN_FILENO, TCSANOW, &tr_priv_saved_termios);
+    }
+}
+static void tr_priv_loop_wait(TrLoop *loop, int timeout_ms) { // Waits for input up to `timeout_ms`(-1 means forever) and reads it to `loop.input`. SIGWINCH wakes it too.
+    struct pollfd pfd = {loop->input_closed ? -1 : STDIN_FILENO, POLLIN, 0};
+    if (poll(&pfd, 1, timeout_ms) <= 0 || !(pfd.revents & (POLLIN | POLLHUP)))
+        return;
+
+    ssize_t n = read(STDIN_FILENO, loop->input + loop->input_len, sizeof(loop->input) - loop->input_len);
+    if (n > 0)
+        loop->input_len += (size_t)n;
+    else if (n == 0)
+        loop->input_closed = true;
+}
 
 #endif // defined(_WIN32) || defined(_WIN64)
 // ----------------------------------------------------------------------------
+
+// Loop
+// ----------------------------------------------------------------------------
+TR_API void tr_loop_init(TrLoop *loop, int fps, TrEventFunc on_event, TrFrameFunc on_frame, void *user) {
+    memset(loop, 0, sizeof(*loop));
+    loop->fps = fps < 0 ? 0 : fps;
+    loop->on_event = on_event;
+    loop->on_frame = on_frame;
+    loop->user = user;
+}
+static int tr_priv_loop_timeout(const TrLoop *loop, double now) { // Milliseconds until the loop has something to do. -1 means forever.
+    int timeout = -1;
+    if (loop->fps > 0) {
+        double left = loop->next_frame - now;
+        timeout = left <= 0 ? 0 : (int)(left * 1000.0) + 1; // Rounds up, so the deadline has passed when it wakes.
+    } else if (loop->damaged) {
+        timeout = 0;
+    }
+
+    if (loop->input_len > 0 && (timeout < 0 || timeout > TR_LOOP_ESC_TIMEOUT_MS)) // The rest of an escape sequence.
+        timeout = TR_LOOP_ESC_TIMEOUT_MS;
+
+    return timeout;
+}
+static void tr_priv_loop_event(TrLoop *loop, const TrEvent *event) {
+    loop->damaged = true;
+    if (loop->on_event != NULL)
+        loop->on_event(loop, event);
+}
+TR_API TrResult tr_loop_run(TrLoop *loop) {
+    if (loop->on_frame == NULL)
+        return TR_ERR_BAD_ARG;
+
+    int width = 0, height = 0;
+    tr_poll_resize(&width, &height); // Starts watching.
+
+    tr_priv_loop_raw(true);
+    loop->running = true;
+    loop->damaged = true;
+    loop->last_frame = loop->next_frame = tr_priv_now();
+
+    while (loop->running) {
+        if (loop->input_closed && loop->fps == 0 && !loop->damaged && loop->input_len == 0) // Waiting would block until a signal.
+            break;
+
+        size_t before = loop->input_len;
+        bool was_closed = loop->input_closed;
+        tr_priv_loop_wait(loop, tr_priv_loop_timeout(loop, tr_priv_now()));
+        bool final = loop->input_len == before || loop->input_len == sizeof(loop->input); // Nothing more came, so a lone ESC is a key.
+
+        while (loop->running && loop->input_len > 0) {
+            TrEvent event;
+            size_t used = tr_decode_key(loop->input, loop->input_len, final, &event);
+            if (used == 0)
+                break;
+
+            loop->input_len -= used;
+            memmove(loop->input, loop->input + used, loop->input_len);
+            if (event.key != TR_KEY_NONE)
+                tr_priv_loop_event(loop, &event);
+        }
+
+        if (loop->running && !was_closed && loop->input_closed) {
+            TrEvent event;
+            memset(&event, 0, sizeof(event));
+            event.type = TR_EVENT_EOF;
+            tr_priv_loop_event(loop, &event);
+        }
+
+        if (loop->running && tr_poll_resize(&width, &height)) {
+            TrEvent event;
+            memset(&event, 0, sizeof(event));
+            event.type = TR_EVENT_RESIZE;
+            event.width = width;
+            event.height = height;
+            tr_priv_loop_event(loop, &event);
+        }
+
+        double now = tr_priv_now();
+        if (!loop->running || (loop->fps > 0 ? now < loop->next_frame : !loop->damaged))
+            continue;
+
+        double dt = now - loop->last_frame;
+        loop->last_frame = now;
+        loop->damaged = false;
+        if (loop->fps > 0) {
+            loop->next_frame += 1.0 / loop->fps;
+            if (loop->next_frame < now) // Too slow. Drops the missed frames instead of catching up.
+                loop->next_frame = now + 1.0 / loop->fps;
+        }
+        loop->on_frame(loop, dt);
+    }
+
+    tr_priv_loop_raw(false);
+    return TR_OK;
+}
+TR_API void tr_loop_stop(TrLoop *loop) {
+    loop->running = false;
+}
+TR_API void tr_loop_damage(TrLoop *loop) {
+    loop->damaged = true;
+}
+// ----------------------------------------------------------------------------
+// ============================================================================
+
+// Recording
+// ============================================================================
+// Helper functions (private)
+// ----------------------------------------------------------------------------
+static const char tr_priv_trace_magic[4] = {'T', 'R', 'T', '1'};
+
+static bool tr_priv_replay_uint(TrReplayer *rp, uint32_t *value) {
+    *value = 0;
+    for (int shift = 0; shift < 35; shift += 7) {
+        int b = fgetc((FILE *)rp->file);
+        if (b == EOF)
+            return false;
+
+        *value |= (uint32_t)(b & 0x7F) << shift;
+        if (!(b & 0x80))
+            return true;
+    }
+    return false;
+}
+static bool tr_priv_replay_int(TrReplayer *rp, int *value) {
+    uint32_t v = 0;
+    if (!tr_priv_replay_uint(rp, &v))
+        return false;
+
+    *value = (v & 1) ? -(int)(v >> 1) - 1 : (int)(v >> 1);
+    return true;
+}
+static bool tr_priv_replay_bytes(TrReplayer *rp, void *dst, size_t len) {
+    return fread(dst, 1, len, (FILE *)rp->file) == len;
+}
+static TrResult tr_priv_replay_letter(TrReplayer *rp, TrRenderContext *ctx, char *cell) { // Reads a letter into a cell. Long graphemes are interned in `ctx`.
+    uint32_t len = 0;
+    char letter[TR_MAX_GRAPHEME_LEN];
+    if (!tr_priv_replay_uint(rp, &len) || len > TR_MAX_GRAPHEME_LEN || !tr_priv_replay_bytes(rp, letter, len))
+        return TR_ERR_IO;
+
+    memset(cell, 0, TR_MAX_UTF8_LEN);
+    if (len <= TR_MAX_UTF8_LEN) {
+        memcpy(cell, letter, len);
+        return TR_OK;
+    }
+    return tr_ctx_intern_grapheme(ctx, letter, len, cell);
+}
+static bool tr_priv_replay_style(TrReplayer *rp, TrStyle *style) {
+    uint32_t effects = 0;
+    if (!tr_priv_replay_uint(rp, &effects) || !tr_priv_replay_uint(rp, &style->fg) || !tr_priv_replay_uint(rp, &style->bg))
+        return false;
+
+    style->effects = (TrEffect)effects;
+    return true;
+}
+static TrResult tr_priv_replay_sprite(TrReplayer *rp, TrRenderContext *ctx, TrCellSpan *sprite, int *x, int *y) { // Reads a sprite record into `rp.sprite`. Long graphemes are interned in `ctx`.
+    int w = 0, h = 0;
+    if (!tr_priv_replay_int(rp, x) || !tr_priv_replay_int(rp, y) || !tr_priv_replay_int(rp, &w) || !tr_priv_replay_int(rp, &h))
+        return TR_ERR_IO;
+
+    *sprite = (TrCellSpan){.width = w, .height = h};
+    if (w <= 0 || h <= 0) // Recorded as it was called. The replayed call fails the same way.
+        return TR_OK;
+
+    size_t len = (size_t)w * (size_t)h;
+    if (len > rp->sprite_cap) {
+        tr_cvec_cleanup(&rp->sprite);
+        rp->sprite_cap = 0;
+        TR_CHK(tr_cvec_init(&rp->sprite, w, h));
+        rp->sprite_cap = len;
+    }
+
+    for (size_t i = 0; i < len; i += 1) {
+        uint32_t effects = 0;
+        TR_CHK(tr_priv_replay_letter(rp, ctx, rp->sprite.letter[i]));
+        if (!tr_priv_replay_uint(rp, &effects) || !tr_priv_replay_uint(rp, &rp->sprite.fg[i]) || !tr_priv_replay_uint(rp, &rp->sprite.bg[i]))
+            return TR_ERR_IO;
+        rp->sprite.effects[i] = (TrEffect)effects;
+    }
+
+    *sprite = rp->sprite;
+    sprite->width = w;
+    sprite->height = h;
+    return TR_OK;
+}
+static TrResult tr_priv_replay_text(TrReplayer *rp, TrStyle *style, size_t *len, int *x, int *y) { // Reads a text record into `rp.text`.
+    uint32_t n = 0;
+    if (!tr_priv_replay_int(rp, x) || !tr_priv_replay_int(rp, y) || !tr_priv_replay_style(rp, style) || !tr_priv_replay_uint(rp, &n))
+        return TR_ERR_IO;
+
+    if (n + 1 > rp->text_cap) {
+        if (rp->text != NULL)
+            TR_FREE(rp->text);
+
+        rp->text_cap = 0;
+        rp->text = TR_MALLOC(n + 1);
+        if (rp->text == NULL)
+            return TR_ERR_ALLOC_FAIL;
+        rp->text_cap = n + 1;
+    }
+    if (!tr_priv_replay_bytes(rp, rp->text, n))
+        return TR_ERR_IO;
+
+    rp->text[n] = '\0';
+    *len = n;
+    return TR_OK;
+}
+static TrResult tr_priv_replay_pixels(TrReplayer *rp, size_t len) { // Reads the pixels of an image record into `rp.pixels`.
+    if (len > rp->pixels_cap) {
+        if (rp->pixels != NULL)
+            TR_FREE(rp->pixels);
+
+        rp->pixels_cap = 0;
+        rp->pixels = TR_MALLOC(len);
+        if (rp->pixels == NULL)
+            return TR_ERR_ALLOC_FAIL;
+        rp->pixels_cap = len;
+    }
+    if (!tr_priv_replay_bytes(rp, rp->pixels, len))
+        return TR_ERR_IO;
+
+    return TR_OK;
+}
+// ----------------------------------------------------------------------------
+TR_API TrResult tr_rec_open(TrRecorder *rec, const char *path, TrRenderContext *ctx) {
+    rec->file = fopen(path, "wb");
+    rec->error = TR_OK;
+    rec->frames = 0;
+    if (rec->file == NULL)
+        return TR_ERR_IO;
+
+    tr_priv_rec_bytes(rec, tr_priv_trace_magic, sizeof(tr_priv_trace_magic));
+    tr_priv_rec_int(rec, ctx->x);
+    tr_priv_rec_int(rec, ctx->y);
+    tr_priv_rec_int(rec, ctx->width);
+    tr_priv_rec_int(rec, ctx->height);
+
+    ctx->recorder = rec;
+    return rec->error;
+}
+TR_API TrResult tr_rec_close(TrRecorder *rec, TrRenderContext *ctx) {
+    if (ctx->recorder == rec)
+        ctx->recorder = NULL;
+
+    if (rec->file != NULL) {
+        if (fclose((FILE *)rec->file) != 0 && rec->error == TR_OK)
+            rec->error = TR_ERR_IO;
+        rec->file = NULL;
+    }
+    return rec->error;
+}
+TR_API TrResult tr_replay_open(TrReplayer *rp, const char *path) {
+    memset(rp, 0, sizeof(*rp));
+    rp->file = fopen(path, "rb");
+    if (rp->file == NULL)
+        return TR_ERR_IO;
+
+    char magic[sizeof(tr_priv_trace_magic)];
+    if (!tr_priv_replay_bytes(rp, magic, sizeof(magic)) || memcmp(magic, tr_priv_trace_magic, sizeof(magic)) != 0 ||
+        !tr_priv_replay_int(rp, &rp->x) || !tr_priv_replay_int(rp, &rp->y) || !tr_priv_replay_int(rp, &rp->width) || !tr_priv_replay_int(rp, &rp->height)) {
+        tr_replay_close(rp);
+        return TR_ERR_IO;
+    }
+
+    return TR_OK;
+}
+TR_API TrResult tr_replay_frame(TrReplayer *rp, TrRenderContext *ctx, bool *done) {
+    *done = false;
+    rp->frame_ms = 0.0;
+
+    for (;;) {
+        int type = fgetc((FILE *)rp->file);
+        if (type == EOF) {
+            *done = true;
+            return TR_OK;
+        }
+
+        double start = 0.0;
+        switch (type) {
+        case TR_PRIV_REC_CLEAR: {
+            uint32_t bg = 0;
+            if (!tr_priv_replay_uint(rp, &bg))
+                return TR_ERR_IO;
+
+            start = tr_priv_now();
+            tr_ctx_clear(ctx, bg);
+            break;
+        }
+        case TR_PRIV_REC_RECT: {
+            int x = 0, y = 0, w = 0, h = 0;
+            uint32_t color = 0;
+            if (!tr_priv_replay_int(rp, &x) || !tr_priv_replay_int(rp, &y) || !tr_priv_replay_int(rp, &w) || !tr_priv_replay_int(rp, &h) || !tr_priv_replay_uint(rp, &color))
+                return TR_ERR_IO;
+
+            start = tr_priv_now();
+            tr_ctx_draw_rect(ctx, x, y, w, h, color);
+            break;
+        }
+        case TR_PRIV_REC_SPRITE: {
+            TrCellSpan sprite;
+            int x = 0, y = 0;
+            TR_CHK(tr_priv_replay_sprite(rp, ctx, &sprite, &x, &y));
+
+            start = tr_priv_now();
+            tr_ctx_draw_sprite(ctx, sprite, x, y);
+            break;
+        }
+        case TR_PRIV_REC_SPRITE_TRANSFORMED: {
+            TrCellSpan sprite;
+            TrTransform transform;
+            uint32_t flips = 0;
+            int x = 0, y = 0;
+            TR_CHK(tr_priv_replay_sprite(rp, ctx, &sprite, &x, &y));
+            if (!tr_priv_replay_uint(rp, &flips) || !tr_priv_replay_int(rp, &transform.rotation) || !tr_priv_replay_int(rp, &transform.scale))
+                return TR_ERR_IO;
+            transform.flip_h = (flips & 1) != 0;
+            transform.flip_v = (flips & 2) != 0;
+
+            start = tr_priv_now();
+            tr_ctx_draw_sprite_transformed(ctx, sprite, x, y, transform);
+            break;
+        }
+        case TR_PRIV_REC_SPRITE_BLENDED: {
+            TrCellSpan sprite;
+            uint32_t opacity = 0;
+            int x = 0, y = 0;
+            TR_CHK(tr_priv_replay_sprite(rp, ctx, &sprite, &x, &y));
+            if (!tr_priv_replay_uint(rp, &opacity))
+                return TR_ERR_IO;
+
+            start = tr_priv_now();
+            tr_ctx_draw_sprite_blended(ctx, sprite, x, y, (uint8_t)opacity);
+            break;
+        }
+        case TR_PRIV_REC_RECT_BLENDED: {
+            int x = 0, y = 0, w = 0, h = 0;
+            uint32_t color = 0, opacity = 0;
+            if (!tr_priv_replay_int(rp, &x) || !tr_priv_replay_int(rp, &y) || !tr_priv_replay_int(rp, &w) || !tr_priv_replay_int(rp, &h) ||
+                !tr_priv_replay_uint(rp, &color) || !tr_priv_replay_uint(rp, &opacity))
+                return TR_ERR_IO;
+
+            start = tr_priv_now();
+            tr_ctx_draw_rect_blended(ctx, x, y, w, h, color, (uint8_t)opacity);
+            break;
+        }
+        case TR_PRIV_REC_IMAGE: {
+            int img_w = 0, img_h = 0, channels = 0, x = 0, y = 0, w = 0, h = 0;
+            if (!tr_priv_replay_int(rp, &img_w) || !tr_priv_replay_int(rp, &img_h) || !tr_priv_replay_int(rp, &channels) || !tr_priv_replay_int(rp, &x) ||
+                !tr_priv_replay_int(rp, &y) || !tr_priv_replay_int(rp, &w) || !tr_priv_replay_int(rp, &h) || img_w <= 0 || img_h <= 0 || (channels != 3 && channels != 4))
+                return TR_ERR_IO;
+            TR_CHK(tr_priv_replay_pixels(rp, (size_t)img_w * (size_t)img_h * (size_t)channels));
+
+            start = tr_priv_now();
+            tr_ctx_draw_image(ctx, rp->pixels, img_w, img_h, channels, x, y, w, h);
+            break;
+        }
+        case TR_PRIV_REC_HLINE:
+        case TR_PRIV_REC_VLINE: {
+            TrStyle style;
+            char cell[TR_MAX_UTF8_LEN];
+            int x = 0, y = 0, len = 0;
+            if (!tr_priv_replay_int(rp, &x) || !tr_priv_replay_int(rp, &y) || !tr_priv_replay_int(rp, &len))
+                return TR_ERR_IO;
+            TR_CHK(tr_priv_replay_letter(rp, ctx, cell));
+            if (!tr_priv_replay_style(rp, &style))
+                return TR_ERR_IO;
+
+            if (len <= 0)
+                return TR_ERR_IO;
+
+            start = tr_priv_now();
+            if (type == TR_PRIV_REC_HLINE) // The cell is not a string, so it is not parsed again.
+                tr_priv_ctx_draw_hline(ctx, x, y, len, cell, style);
+            else
+                tr_priv_ctx_draw_vline(ctx, x, y, len, cell, style);
+            break;
+        }
+        case TR_PRIV_REC_TEXT: {
+            TrStyle style;
+            size_t len = 0;
+            int x = 0, y = 0;
+            TR_CHK(tr_priv_replay_text(rp, &style, &len, &x, &y));
+
+            start = tr_priv_now();
+            tr_ctx_draw_text(ctx, rp->text, len, style, x, y);
+            break;
+        }
+        case TR_PRIV_REC_VIEWPORT: {
+            TrViewport vp;
+            if (!tr_priv_replay_int(rp, &vp.x) || !tr_priv_replay_int(rp, &vp.y) || !tr_priv_replay_int(rp, &vp.clip_x) ||
+                !tr_priv_replay_int(rp, &vp.clip_y) || !tr_priv_replay_int(rp, &vp.clip_w) || !tr_priv_replay_int(rp, &vp.clip_h))
+                return TR_ERR_IO;
+
+            start = tr_priv_now();
+            tr_ctx_set_viewport(ctx, vp);
+            break;
+        }
+        case TR_PRIV_REC_SCROLL:
+        case TR_PRIV_REC_INVALIDATE:
+        case TR_PRIV_REC_RESIZE: {
+            int args[4] = {0, 0, 0, 0};
+            int count = type == TR_PRIV_REC_SCROLL ? 3 : type == TR_PRIV_REC_INVALIDATE ? 4 : 2;
+            for (int i = 0; i < count; i += 1) {
+                if (!tr_priv_replay_int(rp, &args[i]))
+                    return TR_ERR_IO;
+            }
+
+            start = tr_priv_now();
+            if (type == TR_PRIV_REC_SCROLL)
+                tr_ctx_scroll(ctx, args[0], args[1], args[2]);
+            else if (type == TR_PRIV_REC_INVALIDATE)
+                tr_ctx_invalidate(ctx, args[0], args[1], args[2], args[3]);
+            else
+                tr_ctx_resize(ctx, args[0], args[1]);
+            break;
+        }
+        case TR_PRIV_REC_FORGET_TERMINAL:
+            start = tr_priv_now();
+            tr_ctx_forget_terminal(ctx);
+            break;
+        case TR_PRIV_REC_RESET_GRAPHEMES:
+            start = tr_priv_now();
+            tr_ctx_reset_graphemes(ctx);
+            break;
+        case TR_PRIV_REC_TOLERANCE: {
+            int tolerance = 0;
+            if (!tr_priv_replay_int(rp, &tolerance))
+                return TR_ERR_IO;
+
+            start = tr_priv_now();
+            tr_ctx_set_tolerance(ctx, tolerance);
+            break;
+        }
+        case TR_PRIV_REC_ENCODER: {
+            uint32_t colors = 0, effects = 0, caps = 0;
+            if (!tr_priv_replay_uint(rp, &colors) || !tr_priv_replay_uint(rp, &effects) || !tr_priv_replay_uint(rp, &caps) || colors > TR_ENCODER_16)
+                return TR_ERR_IO;
+
+            TrEncoder encoder = tr_encoder((TrEncoderColors)colors, effects != 0);
+            encoder.caps = caps;
+            start = tr_priv_now();
+            tr_ctx_set_encoder(ctx, encoder);
+            break;
+        }
+        case TR_PRIV_REC_CAPS:
+        case TR_PRIV_REC_STYLE_TABLE:
+        case TR_PRIV_REC_LAZY_CLEAR: {
+            uint32_t value = 0;
+            if (!tr_priv_replay_uint(rp, &value))
+                return TR_ERR_IO;
+
+            start = tr_priv_now();
+            if (type == TR_PRIV_REC_CAPS)
+                tr_ctx_set_caps(ctx, value);
+            else if (type == TR_PRIV_REC_STYLE_TABLE)
+                TR_CHK(tr_ctx_set_style_table(ctx, value != 0));
+            else
+                tr_ctx_set_lazy_clear(ctx, value != 0);
+            break;
+        }
+        case TR_PRIV_REC_RENDER:
+            start = tr_priv_now();
+            rp->render_result = tr_ctx_render(ctx);
+            rp->frame_ms += (tr_priv_now() - start) * 1000.0;
+            rp->frames += 1;
+            return TR_OK;
+        default:
+            return TR_ERR_IO;
+        }
+        rp->frame_ms += (tr_priv_now() - start) * 1000.0;
+    }
+}
+TR_API void tr_replay_close(TrReplayer *rp) {
+    if (rp->file != NULL) {
+        fclose((FILE *)rp->file);
+        rp->file = NULL;
+    }
+    tr_cvec_cleanup(&rp->sprite);
+    rp->sprite_cap = 0;
+    if (rp->text != NULL) {
+        TR_FREE(rp->text);
+        rp->text = NULL;
+    }
+    rp->text_cap = 0;
+    if (rp->pixels != NULL) {
+        TR_FREE(rp->pixels);
+        rp->pixels = NULL;
+    }
+    rp->pixels_cap = 0;
+}
 // ============================================================================
 #endif // TR_NO_RENDERER
 